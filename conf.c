@@ -27,6 +27,15 @@ with this program; if not, see <http://www.gnu.org/licenses/>.
 /* initial empty list of lights */
 struct lights_s *_lights = NULL;
 
+/* modules with configured devices */
+unsigned char _confModKnown[32];
+
+/* devices per module */
+struct confModule_s _confModules[256];
+
+/* initial empty list of tags */
+struct confTag_s *_confTags = NULL;
+
 /* initial (default) configuration values */
 struct conf_s _conf =
   {
@@ -35,7 +44,17 @@ struct conf_s _conf =
     4711, /* default server TCP port */
     "/dev/tty.usbserial", /* default name of serial device for LCN-PK */
     NULL,  /* basename of LCN binary log files */
-    "myconf.yali" /* name of server config file */
+    "myconf.yali", /* name of server config file */
+    64,    /* max. number of packets queued per client */
+    NET_OVF_COALESCE, /* policy if client queue overflows */
+    NULL,  /* recording to replay */
+    1.0,   /* replay in real time */
+    LCN_BAUD, /* baud rate of the LCN-PK */
+    1,     /* wake up for every received byte */
+    1,     /* low latency mode of the serial driver */
+    0,     /* LCN-PK at a serial port */
+    "lcn", /* LCN-PCHK user name */
+    "lcn"  /* LCN-PCHK password */
   };
 
 
@@ -50,6 +69,7 @@ void confLightAdd(int module, int output, int state, char *name)
 {
   static struct lights_s *lp = NULL;
   struct lights_s *tmp;
+  struct lights_s **sp;
 
   tmp = (struct lights_s*) malloc(sizeof(struct lights_s));
   if (!tmp)
@@ -63,7 +83,9 @@ void confLightAdd(int module, int output, int state, char *name)
   tmp->name = strdup(name);
   tmp->state = state;
   tmp->time = 0;
+  tmp->dbState = -1;
   tmp->next = NULL;
+  tmp->slotNext = NULL;
   
   /*printf("%i: m%i/%i \"%s\"\n", line, m, o, cbuf+i);*/
   
@@ -77,6 +99,94 @@ void confLightAdd(int module, int output, int state, char *name)
     }
 
   lp = tmp;
+
+  if (output >= 1 && output <= CONF_MOD_SLOTS)
+    {
+      /* several lights on one output are chained in the order they were added */
+      sp = &_confModules[module].light[output-1];
+      while (*sp != NULL) sp = &(*sp)->slotNext;
+      *sp = tmp;
+      _confModKnown[module>>3] |= 1 << (module&7);
+    }
+
+  netDbCacheClear(&_netLightDb);
+}
+
+
+/*! \brief Find light in database
+ *  \param module module ID
+ *  \param output output number
+ *  \return pointer to first light on the output (see slotNext), NULL if unknown
+ */
+struct lights_s *confLightFind(int module, int output)
+{
+  if (module < 0 || module > 255 || output < 1 || output > CONF_MOD_SLOTS)
+    {
+      return NULL;
+    }
+
+  return _confModules[module].light[output-1];
+}
+
+
+/*! \brief Add shutter to the module registry
+ *  \param sp pointer to shutter (module and rnum must be set)
+ *  \return N/A
+ *
+ *  A shutter registered later replaces one with the same number.
+ */
+void confShutReg(struct shutter_s *sp)
+{
+  if (sp->module < 0 || sp->module > 255
+      || sp->rnum < 1 || sp->rnum > CONF_MOD_SLOTS)
+    {
+      return;
+    }
+
+  _confModules[sp->module].shut[sp->rnum-1] = sp;
+  _confModKnown[sp->module>>3] |= 1 << (sp->module&7);
+}
+
+
+/*! \brief Add tag (named range of modules) to database
+ *  \param first first module ID of the range
+ *  \param last last module ID of the range
+ *  \param name name of the tag
+ *  \return N/A
+ */
+void confTagAdd(int first, int last, char *name)
+{
+  struct confTag_s *tmp;
+
+  tmp = (struct confTag_s*) malloc(sizeof(struct confTag_s));
+  if (!tmp)
+    {
+      printf("out of memory");
+      exit(1);
+    }
+
+  tmp->name = strdup(name);
+  tmp->first = first;
+  tmp->last = last;
+  tmp->next = _confTags;
+  _confTags = tmp;
+}
+
+
+/*! \brief Find tag by name
+ *  \param name name of the tag
+ *  \return pointer to tag (NULL if unknown)
+ */
+struct confTag_s *confTagFind(char *name)
+{
+  struct confTag_s *tp;
+
+  for (tp = _confTags; tp != NULL; tp = tp->next)
+    {
+      if (strcmp(tp->name, name) == 0) break;
+    }
+
+  return tp;
 }
 
 
@@ -122,6 +232,15 @@ int confLoad(char *filename)
 	  fclose(fp);
 	  return 1;
 	}
+
+      if ((type == 'L' || type == 'S')
+	  && (m < 0 || m > 255 || o < 1 || o > CONF_MOD_SLOTS))
+	{
+	  printf("%s:%i:error expect module 0..255 and output/shutter 1..%i\n",
+		 filename, line, CONF_MOD_SLOTS);
+	  fclose(fp);
+	  return 1;
+	}
       
       while (cbuf[i]!='\"' && cbuf[i]) i++;
       if (cbuf[i])
@@ -146,6 +265,11 @@ int confLoad(char *filename)
 		}
 	      stateShutCreate(m, o, cbuf+i, p1, p2);
 	    }
+
+	  if (type == 'T')
+	    {
+	      confTagAdd(m, o, cbuf+i);
+	    }
 	}
     }
  
@@ -29,12 +29,62 @@ struct conf_s
   char *lcnInterface;           /*!<\brief device name of the serial port */
   char *lcnBinLogBasename;      /*!<\brief base path+name for LCN binary logs */
   char *serverConfFile;         /*!<\brief filename of the configuration file */
+  unsigned short netOutQueueLen; /*!<\brief max. number of packets queued per client */
+  unsigned char netOverflow;    /*!<\brief NET_OVF_xxx: policy for full client queues */
+  char *lcnReplayName;          /*!<\brief recording to replay instead of using the LCN-PK */
+  double lcnReplaySpeed;        /*!<\brief replay speed (1 = real time, 0 = max.) */
+  int lcnBaud;                  /*!<\brief baud rate of the serial port */
+  unsigned char lcnVmin;        /*!<\brief VMIN: min. number of bytes per wakeup */
+  unsigned char lcnLowLatency;  /*!<\brief 1: ask the driver for low latency */
+  unsigned char lcnPchk;        /*!<\brief 1: lcnInterface is host[:port] of a LCN-PCHK */
+  char *lcnPchkUser;            /*!<\brief user name for the LCN-PCHK login */
+  char *lcnPchkPass;            /*!<\brief password for the LCN-PCHK login */
 };
 
+/*! \brief structure used for named module ranges (linked list element) */
+struct confTag_s
+{
+  char *name;                   /*!<\brief name of the tag */
+  unsigned char first;          /*!<\brief first module ID of the range */
+  unsigned char last;           /*!<\brief last module ID of the range */
+  struct confTag_s *next;       /*!<\brief pointer to next element in linked list */
+};
+
+/*! \brief number of outputs (and shutters) per module kept in the module registry */
+#define CONF_MOD_SLOTS 4
+
+/*! \brief devices connected to one LCN module (module registry entry) */
+struct confModule_s
+{
+  struct lights_s *light[CONF_MOD_SLOTS];  /*!<\brief lights by output number - 1 (see slotNext) */
+  struct shutter_s *shut[CONF_MOD_SLOTS];  /*!<\brief shutters by relay pair number - 1 */
+};
+
+/*! \brief 1 if devices of module m are configured */
+#define CONF_MOD_KNOWN(m) ((_confModKnown[((m)&0xFF)>>3] >> ((m)&7)) & 1)
+
 /*! \brief storage for configuration values */
 extern struct conf_s _conf;
 
+/*! \brief list of tags defined in the configuration file */
+extern struct confTag_s *_confTags;
+
+/*! \brief bitmap of modules with configured devices */
+extern unsigned char _confModKnown[32];
+
+/*! \brief module registry, indexed by module ID */
+extern struct confModule_s _confModules[256];
+
 /*! \brief add module/output to light name association */
 extern void confLightAdd(int module, int output, int state, char *name);
 
+/*! \brief find light by module/output */
+extern struct lights_s *confLightFind(int module, int output);
+
+/*! \brief add shutter to module registry */
+extern void confShutReg(struct shutter_s *sp);
+
+/*! \brief find tag by name */
+extern struct confTag_s *confTagFind(char *name);
+
 #endif
@@ -0,0 +1,552 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/errno.h>
+#include <sys/time.h>
+
+#ifdef __linux__
+#define EV_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#include <sys/select.h>
+#endif
+
+#include "yali.h"
+
+/*! \brief registration data of a single file descriptor */
+struct evFd_s
+{
+  int events;        /*!<\brief events of interest (0 = not registered) */
+  evFdFunc_t func;   /*!<\brief function called when fd is ready */
+  void *ctx;         /*!<\brief argument passed to func */
+  unsigned int gen;  /*!<\brief incremented by each evFdAdd of this fd */
+#ifndef EV_EPOLL
+  unsigned int waitGen; /*!<\brief gen when the fd was passed to select */
+#endif
+};
+
+/*! \brief table of registered file descriptors (indexed by fd) */
+struct evFd_s *_evFdTab = NULL;
+
+/*! \brief number of entries in _evFdTab */
+int _evFdNum = 0;
+
+/*! \brief list of pending timers, sorted by expiry time */
+struct evTimer_s *_evTimerList = NULL;
+
+/*! \brief set by evLoopStop to make evLoopRun return */
+volatile sig_atomic_t _evLoopQuit = 0;
+
+#ifdef EV_EPOLL
+/*! \brief epoll user data: fd in the low, registration (gen) in the high 32 bits */
+#define EV_EPOLL_DATA(fd, gen) (((unsigned long long) (gen) << 32) | (unsigned int) (fd))
+
+/*! \brief epoll instance */
+int _evPollFd = -1;
+
+/*! \brief timerfd armed to the expiry time of the first pending timer */
+int _evTimerFd = -1;
+
+/*! \brief expiry time the timerfd is currently armed to (0 = disarmed) */
+double _evTimerArmed = 0.0;
+#endif
+
+
+/*! \brief obtain monotonic time
+ *  \return time in seconds (arbitrary origin)
+ */
+double evTimeGet(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#endif
+}
+
+
+/*! \brief (re)program the timerfd to the expiry time of the first timer
+ *  \return N/A
+ */
+void evTimerArm(void)
+{
+#ifdef EV_EPOLL
+  struct itimerspec its;
+  double due;
+
+  due = (_evTimerList != NULL) ? _evTimerList->due : 0.0;
+  if (due == _evTimerArmed) return;
+
+  memset(&its, 0, sizeof(its));
+  if (due > 0.0)
+    {
+      its.it_value.tv_sec  = (time_t) due;
+      its.it_value.tv_nsec = (long) ((due - its.it_value.tv_sec) * 1e9);
+      if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+	{
+	  its.it_value.tv_nsec = 1;
+	}
+    }
+
+  if (timerfd_settime(_evTimerFd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+    {
+      perror("timerfd_settime failed");
+      exit(1);
+    }
+
+  _evTimerArmed = due;
+#endif
+}
+
+
+/*! \brief insert timer into sorted list of pending timers
+ *  \param t timer to insert (must not be active)
+ *  \return N/A
+ */
+void evTimerInsert(struct evTimer_s *t)
+{
+  struct evTimer_s **pp;
+
+  pp = &_evTimerList;
+  while (*pp != NULL && (*pp)->due <= t->due)
+    {
+      pp = &(*pp)->next;
+    }
+
+  t->next = *pp;
+  *pp = t;
+  t->active = 1;
+}
+
+
+/*! \brief remove timer from list of pending timers
+ *  \param t timer to remove
+ *  \return N/A
+ */
+void evTimerStop(struct evTimer_s *t)
+{
+  struct evTimer_s **pp;
+
+  if (!t->active) return;
+
+  pp = &_evTimerList;
+  while (*pp != NULL)
+    {
+      if (*pp == t)
+	{
+	  *pp = t->next;
+	  break;
+	}
+      pp = &(*pp)->next;
+    }
+
+  t->next = NULL;
+  t->active = 0;
+
+  evTimerArm();
+}
+
+
+/*! \brief start (or restart) a timer
+ *  \param t pointer to timer structure (owned by caller)
+ *  \param inDelay time until first expiry in seconds
+ *  \param inPeriod period in seconds for periodic timers, 0 for one-shot
+ *  \param inFunc function to call on expiry
+ *  \param inCtx argument passed to inFunc
+ *  \return N/A
+ */
+void evTimerStart(struct evTimer_s *t, double inDelay, double inPeriod,
+		  evTimerFunc_t inFunc, void *inCtx)
+{
+  assert(t != NULL);
+  assert(inFunc != NULL);
+
+  if (t->active) evTimerStop(t);
+
+  t->due    = evTimeGet() + inDelay;
+  t->period = inPeriod;
+  t->func   = inFunc;
+  t->ctx    = inCtx;
+
+  evTimerInsert(t);
+  evTimerArm();
+}
+
+
+/*! \brief call functions of all expired timers
+ *  \return N/A
+ *
+ *  Periodic timers are rescheduled before their function is called,
+ *  so the function may stop or restart its own timer.
+ */
+void evTimerRun(void)
+{
+  struct evTimer_s *t;
+  double now;
+
+  now = evTimeGet();
+
+  while (_evTimerList != NULL && _evTimerList->due <= now)
+    {
+      t = _evTimerList;
+      _evTimerList = t->next;
+      t->next = NULL;
+      t->active = 0;
+
+      if (t->period > 0.0)
+	{
+	  t->due += t->period;
+	  if (t->due < now - 1.0)
+	    {
+	      /* we have been stalled for a long time, don't try to catch up */
+	      t->due = now + t->period;
+	    }
+	  evTimerInsert(t);
+	}
+
+      t->func(t->ctx);
+    }
+
+  evTimerArm();
+}
+
+
+/*! \brief initialize the event loop
+ *  \return 0:OK, -1:ERROR
+ */
+int evLoopInit(void)
+{
+#ifdef EV_EPOLL
+  struct epoll_event ev;
+
+  _evPollFd = epoll_create(16);
+  if (_evPollFd == -1)
+    {
+      perror("epoll_create failed");
+      return -1;
+    }
+
+  _evTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (_evTimerFd == -1)
+    {
+      perror("timerfd_create failed");
+      return -1;
+    }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = EV_EPOLL_DATA(_evTimerFd, 0);
+
+  if (epoll_ctl(_evPollFd, EPOLL_CTL_ADD, _evTimerFd, &ev) == -1)
+    {
+      perror("epoll_ctl timerfd failed");
+      return -1;
+    }
+#endif
+
+  return 0;
+}
+
+
+#ifdef EV_EPOLL
+/*! \brief translate EV_* flags to epoll event mask (edge triggered)
+ *  \param inEvents combination of EV_READ and EV_WRITE
+ *  \return epoll event mask
+ */
+unsigned int evEpollMask(int inEvents)
+{
+  unsigned int mask = EPOLLET;
+
+  if (inEvents & EV_READ) mask |= EPOLLIN;
+  if (inEvents & EV_WRITE) mask |= EPOLLOUT;
+
+  return mask;
+}
+#endif
+
+
+/*! \brief register file descriptor with the event loop
+ *  \param inFd file descriptor
+ *  \param inEvents events of interest (EV_READ, EV_WRITE)
+ *  \param inFunc function called when the descriptor is ready
+ *  \param inCtx argument passed to inFunc
+ *  \return 0:OK, -1:ERROR
+ *
+ *  Readiness is edge triggered, so inFunc has to consume all
+ *  available data (until EAGAIN) each time it is called.
+ */
+int evFdAdd(int inFd, int inEvents, evFdFunc_t inFunc, void *inCtx)
+{
+  struct evFd_s *tmp;
+  int num;
+
+  assert(inFd >= 0);
+  assert(inFunc != NULL);
+
+  if (inFd >= _evFdNum)
+    {
+      num = _evFdNum ? _evFdNum : 16;
+      while (num <= inFd) num *= 2;
+
+      tmp = (struct evFd_s*) realloc(_evFdTab, num * sizeof(struct evFd_s));
+      if (tmp == NULL)
+	{
+	  fprintf(stderr, "out of memory allocating fd table\n");
+	  return -1;
+	}
+
+      memset(&tmp[_evFdNum], 0, (num - _evFdNum) * sizeof(struct evFd_s));
+      _evFdTab = tmp;
+      _evFdNum = num;
+    }
+
+#ifdef EV_EPOLL
+  {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = evEpollMask(inEvents);
+    ev.data.u64 = EV_EPOLL_DATA(inFd, _evFdTab[inFd].gen + 1);
+
+    if (epoll_ctl(_evPollFd, EPOLL_CTL_ADD, inFd, &ev) == -1)
+      {
+	perror("epoll_ctl add failed");
+	return -1;
+      }
+  }
+#endif
+
+  _evFdTab[inFd].events = inEvents | EV_ERROR;
+  _evFdTab[inFd].func = inFunc;
+  _evFdTab[inFd].ctx = inCtx;
+  _evFdTab[inFd].gen++;
+
+  return 0;
+}
+
+
+/*! \brief change events of interest for a registered file descriptor
+ *  \param inFd file descriptor
+ *  \param inEvents new events of interest (EV_READ, EV_WRITE)
+ *  \return 0:OK, -1:ERROR
+ */
+int evFdMod(int inFd, int inEvents)
+{
+  assert(inFd >= 0 && inFd < _evFdNum);
+  assert(_evFdTab[inFd].events != 0);
+
+  inEvents |= EV_ERROR;
+  if (_evFdTab[inFd].events == inEvents) return 0;
+
+#ifdef EV_EPOLL
+  {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = evEpollMask(inEvents);
+    ev.data.u64 = EV_EPOLL_DATA(inFd, _evFdTab[inFd].gen);
+
+    if (epoll_ctl(_evPollFd, EPOLL_CTL_MOD, inFd, &ev) == -1)
+      {
+	perror("epoll_ctl mod failed");
+	return -1;
+      }
+  }
+#endif
+
+  _evFdTab[inFd].events = inEvents;
+
+  return 0;
+}
+
+
+/*! \brief remove file descriptor from the event loop
+ *  \param inFd file descriptor (has to be called before close)
+ *  \return N/A
+ */
+void evFdDel(int inFd)
+{
+  if (inFd < 0 || inFd >= _evFdNum || _evFdTab[inFd].events == 0) return;
+
+#ifdef EV_EPOLL
+  {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(_evPollFd, EPOLL_CTL_DEL, inFd, &ev);
+  }
+#endif
+
+  _evFdTab[inFd].events = 0;
+  _evFdTab[inFd].func = NULL;
+  _evFdTab[inFd].ctx = NULL;
+}
+
+
+/*! \brief call handler of a file descriptor
+ *  \param inFd file descriptor that is ready
+ *  \param inGen registration (gen) the events were reported for
+ *  \param inEvents events that occured
+ *  \return N/A
+ *
+ *  An earlier handler of the same batch may have closed the descriptor
+ *  and a new one with the same number may have been registered since,
+ *  so events of an old registration are ignored.
+ */
+void evFdDispatch(int inFd, unsigned int inGen, int inEvents)
+{
+  struct evFd_s *fp;
+
+  if (inFd < 0 || inFd >= _evFdNum) return;
+
+  fp = &_evFdTab[inFd];
+  if (fp->gen != inGen) return;
+
+  /* descriptor may have been removed by an earlier handler */
+  inEvents &= fp->events;
+  if (inEvents == 0) return;
+
+  fp->func(inFd, inEvents, fp->ctx);
+}
+
+
+/*! \brief make evLoopRun return (may be called from a signal handler)
+ *  \return N/A
+ */
+void evLoopStop(void)
+{
+  _evLoopQuit = 1;
+}
+
+
+/*! \brief wait for and process events until evLoopStop is called
+ *  \return N/A
+ */
+void evLoopRun(void)
+{
+#ifdef EV_EPOLL
+  struct epoll_event evs[32];
+  unsigned long long exp;
+  int events;
+  int n;
+  int i;
+
+  while (!_evLoopQuit)
+    {
+      n = epoll_wait(_evPollFd, evs, 32, -1);
+      if (n == -1)
+	{
+	  if (errno == EINTR) continue;
+	  perror("epoll_wait failed");
+	  exit(1);
+	}
+
+      for (i=0; i<n; i++)
+	{
+	  if (evs[i].data.u64 == EV_EPOLL_DATA(_evTimerFd, 0))
+	    {
+	      while (read(_evTimerFd, &exp, sizeof(exp)) > 0);
+	      continue;
+	    }
+
+	  events = 0;
+	  if (evs[i].events & EPOLLIN) events |= EV_READ;
+	  if (evs[i].events & EPOLLOUT) events |= EV_WRITE;
+	  if (evs[i].events & (EPOLLERR | EPOLLHUP)) events |= EV_ERROR;
+
+	  evFdDispatch((int) (evs[i].data.u64 & 0xFFFFFFFF),
+		       (unsigned int) (evs[i].data.u64 >> 32), events);
+	}
+
+      evTimerRun();
+    }
+#else
+  fd_set readfs;
+  fd_set writefs;
+  fd_set errorfs;
+  struct timeval tv;
+  struct timeval *tvp;
+  double wait;
+  int maxfd;
+  int events;
+  int fd;
+  int n;
+
+  while (!_evLoopQuit)
+    {
+      FD_ZERO(&readfs);
+      FD_ZERO(&writefs);
+      FD_ZERO(&errorfs);
+
+      maxfd = -1;
+      for (fd=0; fd<_evFdNum; fd++)
+	{
+	  if (_evFdTab[fd].events == 0) continue;
+	  if (_evFdTab[fd].events & EV_READ) FD_SET(fd, &readfs);
+	  if (_evFdTab[fd].events & EV_WRITE) FD_SET(fd, &writefs);
+	  FD_SET(fd, &errorfs);
+	  _evFdTab[fd].waitGen = _evFdTab[fd].gen;
+	  maxfd = fd;
+	}
+
+      tvp = NULL;
+      if (_evTimerList != NULL)
+	{
+	  wait = _evTimerList->due - evTimeGet();
+	  if (wait < 0.0) wait = 0.0;
+	  tv.tv_sec  = (long) wait;
+	  tv.tv_usec = (long) ((wait - tv.tv_sec) * 1e6);
+	  tvp = &tv;
+	}
+
+      n = select(maxfd + 1, &readfs, &writefs, &errorfs, tvp);
+      if (n == -1 && errno != EINTR)
+	{
+	  perror("select failed");
+	  exit(1);
+	}
+
+      for (fd=0; n>0 && fd<=maxfd; fd++)
+	{
+	  events = 0;
+	  if (FD_ISSET(fd, &readfs)) events |= EV_READ;
+	  if (FD_ISSET(fd, &writefs)) events |= EV_WRITE;
+	  if (FD_ISSET(fd, &errorfs)) events |= EV_ERROR;
+
+	  if (events != 0) evFdDispatch(fd, _evFdTab[fd].waitGen, events);
+	}
+
+      evTimerRun();
+    }
+#endif
+}
@@ -0,0 +1,57 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+/* event flags used for registration and notification of file descriptors */
+
+#define EV_READ   0x01
+#define EV_WRITE  0x02
+#define EV_ERROR  0x04
+
+/*! \brief callback invoked when a registered file descriptor is ready */
+typedef void (*evFdFunc_t)(int inFd, int inEvents, void *inCtx);
+
+/*! \brief callback invoked when a timer expires */
+typedef void (*evTimerFunc_t)(void *inCtx);
+
+/*! \brief structure describing a (one-shot or periodic) timer */
+struct evTimer_s
+{
+  double due;              /*!<\brief absolute expiry time (see evTimeGet) */
+  double period;           /*!<\brief period in seconds, 0 for one-shot timers */
+  evTimerFunc_t func;      /*!<\brief function to call on expiry */
+  void *ctx;               /*!<\brief argument passed to func */
+  int active;              /*!<\brief 1 if timer is in the list of pending timers */
+  struct evTimer_s *next;  /*!<\brief next timer (sorted by expiry time) */
+};
+
+extern int evLoopInit(void);
+extern void evLoopRun(void);
+extern void evLoopStop(void);
+extern int evFdAdd(int inFd, int inEvents, evFdFunc_t inFunc, void *inCtx);
+extern int evFdMod(int inFd, int inEvents);
+extern void evFdDel(int inFd);
+extern double evTimeGet(void);
+extern void evTimerStart(struct evTimer_s *t, double inDelay, double inPeriod,
+			 evTimerFunc_t inFunc, void *inCtx);
+extern void evTimerStop(struct evTimer_s *t);
+
+#endif /* _EVENT_LOOP_H */
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+##############################################################################
+# YALI - Yet Another LCN Interface
+#
+# Copyright (C) 2009 Daniel Dallmann
+#
+# This program is free software; you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, see <http://www.gnu.org/licenses/>.
+##############################################################################
+#
+#
+# lcnAckTest - check that a module which never acks does not block others
+#
+# Runs pchkStub with module 11 muted and yaliServ connected to it, sends
+# more commands to module 11 than packets fit into the ack window, then
+# commands to module 12. Those have to reach the stub within DEADLINE,
+# while the first packet for module 11 is still being repeated.
+#
+#   ./lcnAckTest.py
+#
+##############################################################################
+
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+MUTE = 11
+DRIVEN = 12
+DEADLINE = 0.3
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(('127.0.0.1', 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def wait_port(port, timeout):
+    end = time.time() + timeout
+    while time.time() < end:
+        try:
+            return socket.create_connection(('127.0.0.1', port))
+        except OSError:
+            time.sleep(0.1)
+    return None
+
+
+def main():
+    pchk_port = free_port()
+    port = free_port()
+
+    lines = []
+    stub = subprocess.Popen([sys.executable, '-u', './pchkStub.py',
+                             '-p', str(pchk_port), '-n', str(MUTE)],
+                            stdout=subprocess.PIPE, universal_newlines=True)
+    threading.Thread(target=lambda: lines.extend(stub.stdout),
+                     daemon=True).start()
+    time.sleep(0.5)
+
+    srv = subprocess.Popen(['./yaliServ', '-P', '127.0.0.1:%d' % pchk_port,
+                            '-p', str(port)],
+                           stdout=subprocess.DEVNULL, stderr=subprocess.STDOUT)
+    try:
+        c = wait_port(port, 5.0)
+        if c is None:
+            print('FAIL: yaliServ not reachable')
+            return 1
+
+        # one command at a time, so they are not coalesced in the queue
+        for i in range(20):
+            c.sendall(bytes([0x03, 0, 3, MUTE, 1 + i % 3, 2 * i]))
+            time.sleep(0.02)
+
+        start = time.time()
+        for i in range(5):
+            c.sendall(bytes([0x03, 0, 3, DRIVEN, 1 + i, 50]))
+
+        want = ['>M000%03d!A%dDI050' % (DRIVEN, i + 1) for i in range(3)]
+        while time.time() - start < DEADLINE:
+            if all(any(w in l for l in lines) for w in want):
+                break
+            time.sleep(0.01)
+        else:
+            print('FAIL: commands to module %d blocked by module %d' % (DRIVEN, MUTE))
+            return 1
+
+        print('OK: module %d served after %.0f ms while module %d does not ack'
+              % (DRIVEN, 1000.0 * (time.time() - start), MUTE))
+        return 0
+    finally:
+        srv.terminate()
+        srv.wait()
+        stub.terminate()
+        stub.wait()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
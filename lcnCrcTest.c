@@ -0,0 +1,224 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+  lcnCrcTest - check _lcnCrcTab against the reference lcnCrcStep
+
+  Compares LCN_CRC_STEP with lcnCrcStep for every pair of data byte and
+  CRC value. Then times lcnCrcCalc and lcnCrcCheck against copies that
+  calculate each step like lcnCrcStep, on packets of the lengths seen on
+  the bus. Exits with 1 if any entry of the table or any result differs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "yali.h"
+
+/*! \brief number of packets in the timing data */
+#define LCN_CRC_TEST_PAKS   4096
+
+/*! \brief number of times the timing data is checked */
+#define LCN_CRC_TEST_LOOPS  1000
+
+/*! \brief packets per lcnCrcCheck call (as in lcnDecode) */
+#define LCN_CRC_TEST_BATCH  256
+
+
+/*! \brief current time in seconds
+ *  \return seconds since 1970
+ */
+double crcTime(void)
+{
+  struct timeval t;
+
+  gettimeofday(&t, NULL);
+  return t.tv_sec + 1e-6 * t.tv_usec;
+}
+
+
+/*! \brief lcnCrcStep, in this file so the compiler may inline it
+ *  \param x new data byte to add
+ *  \param store CRC calculated so far
+ *  \return new CRC value
+ */
+int crcStepRef(int x, int store)
+{
+  int c;
+  int new = x + store;
+
+  c = (( new & 0x7f ) << 2 ) | (( new & 0x180 ) >> 7 );
+  if ( c > 0xff ) { c = c-0xff; }
+
+  return c;
+}
+
+
+/*! \brief lcnCrcCalc without the table
+ *  \param data pointer to LCN packet
+ *  \param len length of LCN packet
+ *  \return calculated CRC value
+ */
+unsigned char crcCalcRef(unsigned char *data, int len)
+{
+  int crc = 0;
+  int count;
+
+  if (len > 0) crc = crcStepRef(data[0], crc);
+  if (len > 1) crc = crcStepRef(data[1], crc);
+
+  for (count = 3; count < len; count++)
+    {
+      crc = crcStepRef(data[count], crc);
+    }
+
+  return crc;
+}
+
+
+/*! \brief lcnCrcCheck without the table
+ *  \param inPaks pointers to the packets
+ *  \param inLens lengths of the packets
+ *  \param inNum number of packets
+ *  \param outOk set to 1 for each packet with valid CRC, 0 otherwise
+ *  \return number of packets with valid CRC
+ */
+int crcCheckRef(unsigned char **inPaks, int *inLens, int inNum, unsigned char *outOk)
+{
+  int i;
+  int ok;
+  int num;
+
+  num = 0;
+  for (i=0; i<inNum; i++)
+    {
+      ok = (inLens[i] >= 3 && crcCalcRef(inPaks[i], inLens[i]) == inPaks[i][2]);
+      outOk[i] = ok;
+      num += ok;
+    }
+
+  return num;
+}
+
+
+int main(int argc, char **argv)
+{
+  static unsigned char data[LCN_CRC_TEST_PAKS * LCN_FRAME_MAX];
+  static unsigned char *paks[LCN_CRC_TEST_PAKS];
+  static int lens[LCN_CRC_TEST_PAKS];
+  static unsigned char ok[LCN_CRC_TEST_PAKS];
+  volatile int sink;
+  double t0, tRef, tTab;
+  double bytes;
+  int errors;
+  int x,s,i,n;
+  int num;
+
+  /* every (byte, state) pair */
+
+  errors = 0;
+  for (x=0; x<256; x++)
+    {
+      for (s=0; s<256; s++)
+	{
+	  if (LCN_CRC_STEP(x, s) != lcnCrcStep(x, s))
+	    {
+	      if (errors < 10)
+		{
+		  printf("mismatch: byte 0x%02X, CRC 0x%02X: table 0x%02X, reference 0x%02X\n",
+			 x, s, LCN_CRC_STEP(x, s), lcnCrcStep(x, s));
+		}
+	      errors++;
+	    }
+	}
+    }
+  printf("%i of 65536 (byte, CRC) pairs differ\n", errors);
+
+  /* packets of typical lengths, half of them with valid CRC */
+
+  srand(1);
+  bytes = 0.0;
+  for (i=0; i<LCN_CRC_TEST_PAKS; i++)
+    {
+      x = rand() % 4;
+      lens[i] = (x == 0) ? 6 : (x == 3) ? 20 : 8;
+      paks[i] = &data[i * LCN_FRAME_MAX];
+      for (n=0; n<lens[i]; n++) paks[i][n] = rand();
+      paks[i][2] = lcnCrcCalc(paks[i], lens[i]) ^ (i % 2);
+      if (crcCalcRef(paks[i], lens[i]) != lcnCrcCalc(paks[i], lens[i])) errors++;
+      bytes += lens[i];
+    }
+  bytes *= LCN_CRC_TEST_LOOPS;
+
+  /* lcnCrcCalc, one call per packet */
+
+  num = 0;
+  t0 = crcTime();
+  for (s=0; s<LCN_CRC_TEST_LOOPS; s++)
+    {
+      for (i=0; i<LCN_CRC_TEST_PAKS; i++) num += crcCalcRef(paks[i], lens[i]);
+    }
+  tRef = crcTime() - t0;
+  sink = num;
+
+  num = 0;
+  t0 = crcTime();
+  for (s=0; s<LCN_CRC_TEST_LOOPS; s++)
+    {
+      for (i=0; i<LCN_CRC_TEST_PAKS; i++) num += lcnCrcCalc(paks[i], lens[i]);
+    }
+  tTab = crcTime() - t0;
+  if (num != sink) errors++;
+
+  printf("lcnCrcCalc:  step %6.1f MB/s, table %6.1f MB/s (%.1f vs %.1f ns per packet)\n",
+	 bytes / tRef / 1e6, bytes / tTab / 1e6,
+	 1e9 * tRef / LCN_CRC_TEST_PAKS / LCN_CRC_TEST_LOOPS,
+	 1e9 * tTab / LCN_CRC_TEST_PAKS / LCN_CRC_TEST_LOOPS);
+
+  /* lcnCrcCheck, batches as in lcnDecode */
+
+  num = 0;
+  t0 = crcTime();
+  for (s=0; s<LCN_CRC_TEST_LOOPS; s++)
+    {
+      for (i=0; i<LCN_CRC_TEST_PAKS; i+=LCN_CRC_TEST_BATCH)
+	{
+	  num += crcCheckRef(&paks[i], &lens[i], LCN_CRC_TEST_BATCH, &ok[i]);
+	}
+    }
+  tRef = crcTime() - t0;
+  sink = num;
+
+  num = 0;
+  t0 = crcTime();
+  for (s=0; s<LCN_CRC_TEST_LOOPS; s++)
+    {
+      for (i=0; i<LCN_CRC_TEST_PAKS; i+=LCN_CRC_TEST_BATCH)
+	{
+	  num += lcnCrcCheck(&paks[i], &lens[i], LCN_CRC_TEST_BATCH, &ok[i]);
+	}
+    }
+  tTab = crcTime() - t0;
+  if (num != sink || num != LCN_CRC_TEST_LOOPS * LCN_CRC_TEST_PAKS / 2) errors++;
+
+  printf("lcnCrcCheck: step %6.1f MB/s, table %6.1f MB/s\n",
+	 bytes / tRef / 1e6, bytes / tTab / 1e6);
+
+  return (errors == 0) ? 0 : 1;
+}
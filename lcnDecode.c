@@ -0,0 +1,372 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  lcnDecode - offline decoder for recorded LCN traffic
+
+  Reads logs written by yaliServ -b (<prefix>_NNNN.lcnlog) or files with
+  raw serial data and writes one line (or record) per LCN packet:
+
+  -t  text, decoded like the server prints it with -v (default)
+  -c  CSV: time,dir,src,seg,dst,info,cmd,p1,p2,len,crc,type,data
+  -b  binary summary, 16 bytes per packet (numbers in network byte order):
+
+      0..3   time (seconds since 1970, 0 for raw data)
+      4..5   milliseconds
+      6      flags (LCN_DEC_TX, LCN_DEC_CRCOK)
+      7      length of the packet
+      8      source module
+      9..14  segment, destination, info, command, parameter 1 and 2
+      15     index of the matching entry in _pkDecList (0xFF if none)
+
+  Input files are memory mapped, statistics are printed to stderr.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "yali.h"
+
+#define LCN_DEC_TEXT   0
+#define LCN_DEC_CSV    1
+#define LCN_DEC_BIN    2
+
+#define LCN_DEC_TX     0x01 /* packet has been sent by the server */
+#define LCN_DEC_CRCOK  0x02 /* CRC of the packet is valid */
+
+/*! \brief number of log records whose CRCs are checked at once */
+#define LCN_DEC_BATCH  256
+
+/*! \brief output format (LCN_DEC_xxx) */
+int _decFormat = LCN_DEC_TEXT;
+
+/* statistics */
+unsigned long _decPaks = 0;
+unsigned long _decCrcErrors = 0;
+unsigned long _decGarbage = 0;
+double _decBytes = 0.0;
+
+
+/*! \brief write one decoded packet
+ *  \param inTime recording time (seconds since 1970, 0 if unknown)
+ *  \param inDir LCN_LOG_RX or LCN_LOG_TX
+ *  \param p pointer to LCN packet
+ *  \param len length of LCN packet
+ *  \param crcOk 1 if the CRC is valid
+ *  \return N/A
+ */
+void decPak(double inTime, int inDir, unsigned char *p, int len, int crcOk)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  unsigned char rec[16];
+  char line[128];
+  uint32_t tmp;
+  int type;
+  int i,n;
+
+  _decPaks++;
+
+  if (!crcOk) _decCrcErrors++;
+
+  switch (_decFormat)
+    {
+    case LCN_DEC_TEXT:
+      printf("%.3f %s ", inTime, (inDir == LCN_LOG_TX) ? "TX" : "RX");
+      lcnPrint2(p, len);
+      break;
+
+    case LCN_DEC_CSV:
+      type = (len >= 6) ? lcnPkMatch(p, len) : -1;
+      printf("%.3f,%s,", inTime, (inDir == LCN_LOG_TX) ? "tx" : "rx");
+      if (len >= 6)
+	{
+	  printf("%i,%i,%i,%i,%i,", _lcnBitRev[p[0]], p[3], p[4], p[1], p[5]);
+	}
+      else
+	{
+	  printf(",,,,,");
+	}
+      if (len >= 8) printf("%i,%i,", p[6], p[7]);
+      else printf(",,");
+      printf("%i,%i,%i,", len, crcOk, type);
+      n = 0;
+      for (i=0; i<len && n+3 < sizeof(line); i++)
+	{
+	  line[n++] = hex[p[i] >> 4];
+	  line[n++] = hex[p[i] & 15];
+	}
+      line[n++] = '\n';
+      fwrite(line, 1, n, stdout);
+      break;
+
+    case LCN_DEC_BIN:
+      memset(rec, 0, sizeof(rec));
+      tmp = htonl((uint32_t) inTime);
+      memcpy(rec, &tmp, 4);
+      n = (int) (1000.0 * (inTime - (uint32_t) inTime));
+      rec[4] = n >> 8;
+      rec[5] = n & 0xFF;
+      rec[6] = ((inDir == LCN_LOG_TX) ? LCN_DEC_TX : 0) | (crcOk ? LCN_DEC_CRCOK : 0);
+      rec[7] = len;
+      if (len > 0) rec[8] = _lcnBitRev[p[0]];
+      if (len > 3) rec[9] = p[3];
+      if (len > 4) rec[10] = p[4];
+      if (len > 1) rec[11] = p[1];
+      if (len > 5) rec[12] = p[5];
+      if (len > 6) rec[13] = p[6];
+      if (len > 7) rec[14] = p[7];
+      type = (len >= 6) ? lcnPkMatch(p, len) : -1;
+      rec[15] = (type < 0) ? 0xFF : type;
+      fwrite(rec, 1, sizeof(rec), stdout);
+      break;
+    }
+}
+
+
+/*! \brief decode a log written by yaliServ -b
+ *  \param d mapped file
+ *  \param size size of the file
+ *  \return N/A
+ *
+ *  Records are collected in batches of LCN_DEC_BATCH, whose CRCs are
+ *  checked with one call of lcnCrcCheck.
+ */
+void decLog(unsigned char *d, size_t size)
+{
+  unsigned char *paks[LCN_DEC_BATCH];
+  int lens[LCN_DEC_BATCH];
+  unsigned char ok[LCN_DEC_BATCH];
+  size_t recs[LCN_DEC_BATCH];
+  size_t off;
+  double start;
+  uint32_t tmp;
+  int len;
+  int i,n;
+
+  memcpy(&tmp, &d[8], 4);
+  start = ntohl(tmp);
+
+  off = LCN_LOG_HDR;
+  while (off + LCN_LOG_REC <= size)
+    {
+      n = 0;
+      while (n < LCN_DEC_BATCH && off + LCN_LOG_REC <= size)
+	{
+	  len = d[off];
+	  if (off + LCN_LOG_REC + len > size) break;
+
+	  recs[n] = off;
+	  paks[n] = &d[off+LCN_LOG_REC];
+	  lens[n] = len;
+	  n++;
+	  off += LCN_LOG_REC + len;
+	}
+
+      lcnCrcCheck(paks, lens, n, ok);
+
+      for (i=0; i<n; i++)
+	{
+	  memcpy(&tmp, &d[recs[i]+2], 4);
+	  decPak(start + 0.001 * ntohl(tmp), d[recs[i]+1], paks[i], lens[i], ok[i]);
+	}
+
+      if (n < LCN_DEC_BATCH && off + LCN_LOG_REC <= size)
+	{
+	  fprintf(stderr, "truncated record at offset %lu\n", (unsigned long) off);
+	  break;
+	}
+    }
+}
+
+
+/*! \brief framer callback for a valid packet in raw serial data
+ *  \param p pointer to LCN packet
+ *  \param inLen length of LCN packet
+ *  \return N/A
+ */
+void decRawPak(unsigned char *p, int inLen)
+{
+  decPak(0.0, LCN_LOG_RX, p, inLen, 1);
+}
+
+
+/*! \brief framer callback for bytes not belonging to a valid packet
+ *  \param p pointer to skipped bytes
+ *  \param inLen number of skipped bytes
+ *  \return N/A
+ */
+void decRawJunk(unsigned char *p, int inLen)
+{
+  _decGarbage += inLen;
+}
+
+
+/*! \brief split raw serial data into LCN packets and decode them
+ *  \param d mapped file
+ *  \param size size of the file
+ *  \return N/A
+ *
+ *  Uses the same framer as the server, so packets are split exactly as
+ *  yaliServ would have split them.
+ */
+void decRaw(unsigned char *d, size_t size)
+{
+  struct lcnFramer_s f;
+  size_t off;
+
+  lcnFramerInit(&f, decRawPak, decRawJunk);
+
+  for (off=0; off<size; off++)
+    {
+      lcnFramerByte(&f, d[off]);
+    }
+  lcnFramerFlush(&f);
+
+  _decCrcErrors += f.crcErrors;
+}
+
+
+/*! \brief decode one file
+ *  \param inName file name
+ *  \return 0:OK, -1:error
+ */
+int decFile(char *inName)
+{
+  struct stat st;
+  unsigned char *d;
+  int fd;
+
+  fd = open(inName, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0)
+    {
+      perror(inName);
+      if (fd >= 0) close(fd);
+      return -1;
+    }
+
+  if (st.st_size == 0)
+    {
+      close(fd);
+      return 0;
+    }
+
+  d = (unsigned char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (d == MAP_FAILED)
+    {
+      perror(inName);
+      return -1;
+    }
+#ifdef MADV_SEQUENTIAL
+  madvise(d, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+  if (st.st_size >= LCN_LOG_HDR && memcmp(d, LCN_LOG_MAGIC, 8) == 0)
+    {
+      decLog(d, st.st_size);
+    }
+  else
+    {
+      decRaw(d, st.st_size);
+    }
+
+  _decBytes += st.st_size;
+  munmap(d, st.st_size);
+
+  return 0;
+}
+
+
+void usage(char *appname)
+{
+  printf("%s: [-h] [-t|-c|-b] [-o <outfile>] <capture> ...\n"
+	 "  -t text (default), -c CSV, -b binary summary\n", appname);
+}
+
+
+int main(int argc, char **argv)
+{
+  struct timeval t0, t1;
+  double dt;
+  int ret;
+  int i;
+
+  i = 1;
+  while (i < argc && argv[i][0] == '-')
+    {
+      if (strcmp(argv[i], "-t") == 0) _decFormat = LCN_DEC_TEXT;
+      else if (strcmp(argv[i], "-c") == 0) _decFormat = LCN_DEC_CSV;
+      else if (strcmp(argv[i], "-b") == 0) _decFormat = LCN_DEC_BIN;
+      else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+	{
+	  i++;
+	  if (freopen(argv[i], "w", stdout) == NULL)
+	    {
+	      perror(argv[i]);
+	      exit(1);
+	    }
+	}
+      else
+	{
+	  usage(argv[0]);
+	  exit(strcmp(argv[i], "-h") == 0 ? 0 : 1);
+	}
+      i++;
+    }
+
+  if (i == argc)
+    {
+      usage(argv[0]);
+      exit(1);
+    }
+
+  setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
+  if (_decFormat == LCN_DEC_CSV)
+    {
+      printf("time,dir,src,seg,dst,info,cmd,p1,p2,len,crc,type,data\n");
+    }
+
+  gettimeofday(&t0, NULL);
+
+  ret = 0;
+  for ( ; i < argc; i++)
+    {
+      if (decFile(argv[i]) != 0) ret = 1;
+    }
+
+  fflush(stdout);
+  gettimeofday(&t1, NULL);
+  dt = (t1.tv_sec - t0.tv_sec) + 1e-6 * (t1.tv_usec - t0.tv_usec);
+  if (dt <= 0.0) dt = 1e-6;
+
+  fprintf(stderr, "%.0f bytes, %lu packets, %lu CRC errors, %lu garbage bytes "
+	  "in %.2f s (%.1f MB/s)\n", _decBytes, _decPaks, _decCrcErrors,
+	  _decGarbage, dt, _decBytes / dt / 1e6);
+
+  return ret;
+}
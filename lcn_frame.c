@@ -0,0 +1,256 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "yali.h"
+
+
+/*! \brief initialize a framer
+ *  \param f pointer to framer
+ *  \param inPak called for each valid packet
+ *  \param inJunk called for bytes that do not belong to a valid packet
+ *  \return N/A
+ */
+void lcnFramerInit(struct lcnFramer_s *f, lcnFrameFunc_t inPak, lcnFrameFunc_t inJunk)
+{
+  memset(f, 0, sizeof(*f));
+  f->pak = inPak;
+  f->junk = inJunk;
+}
+
+
+/*! \brief clear buffered bytes of a framer (counters are kept)
+ *  \param f pointer to framer
+ *  \return N/A
+ */
+void lcnFramerReset(struct lcnFramer_s *f)
+{
+  f->head = 0;
+  f->len = 0;
+  f->lazy = 0;
+  f->lost = 0;
+  f->junkLen = 0;
+}
+
+
+/*! \brief pass dropped bytes to the junk function
+ *  \param f pointer to framer
+ *  \return N/A
+ *
+ *  Bytes that do not belong to a valid packet (e.g. status strings of
+ *  the LCN-PK) are collected and handed on in one block, so they still
+ *  show up in the traffic dump and the binary log of the server.
+ */
+void lcnFramerJunkFlush(struct lcnFramer_s *f)
+{
+  if (f->junkLen == 0) return;
+
+  f->junk(f->junkBuf, f->junkLen);
+  f->junkLen = 0;
+}
+
+
+/*! \brief remove bytes from the start of the framer buffer
+ *  \param f pointer to framer
+ *  \param n number of bytes to remove
+ *  \return N/A
+ */
+void lcnFramerDrop(struct lcnFramer_s *f, int n)
+{
+  f->head = (f->head + n) & (LCN_FRAME_RING - 1);
+  f->len -= n;
+}
+
+
+/*! \brief update a possible packet with its latest byte
+ *  \param c pointer to candidate
+ *  \param b pointer to the first byte of the packet
+ *  \param n number of bytes of the packet received so far
+ *  \return N/A
+ */
+void lcnFramerCandStep(struct lcnCand_s *c, unsigned char *b, int n)
+{
+  if (c->state != LCN_CAND_PENDING) return;
+
+  if (n != 3) c->crc = LCN_CRC_STEP(b[n-1], c->crc);
+  if (n == 2) c->expLen = lcnFrameLen(b[1]);
+  if (n < 3) return;
+
+  if (c->expLen != 0)
+    {
+      if (n < c->expLen) return;
+      c->state = (c->crc == b[2]) ? LCN_CAND_OK : LCN_CAND_BAD;
+    }
+  else if ( (n==6 || n==8 || n==12 || n==20) && c->crc == b[2] )
+    {
+      c->state = LCN_CAND_OK;
+    }
+  else if (n == LCN_FRAME_MAX)
+    {
+      c->state = LCN_CAND_BAD;
+    }
+  c->len = n;
+}
+
+
+/*! \brief bring the possible packets behind the oldest one up to date
+ *  \param f pointer to framer
+ *  \return N/A
+ *
+ *  Called when the oldest packet, whose length was known, turned out to
+ *  be bad. The candidates are recalculated from the buffered bytes.
+ */
+void lcnFramerCatchUp(struct lcnFramer_s *f)
+{
+  struct lcnCand_s *c;
+  unsigned char *b;
+  int i,n;
+
+  b = &f->buf[f->head];
+  for (i=1; i<f->len; i++)
+    {
+      c = &f->cand[(f->head + i) & (LCN_FRAME_RING - 1)];
+      c->crc = 0;
+      c->expLen = 0;
+      c->state = LCN_CAND_PENDING;
+      for (n=1; n<=f->len-i; n++) lcnFramerCandStep(c, &b[i], n);
+    }
+
+  f->lazy = 0;
+}
+
+
+/*! \brief feed one received byte into a framer
+ *  \param f pointer to framer
+ *  \param inByte received byte
+ *  \return N/A
+ *
+ *  Every buffered byte is the start of a possible packet whose CRC is
+ *  updated as bytes arrive. The oldest possible packet decides: if it
+ *  completes with a valid CRC it is passed to the packet function, if
+ *  not its first byte is dropped and the next one takes over. Packets
+ *  with an unknown info field are accepted at a typical length with
+ *  valid CRC, but are dropped as soon as a later packet of known type
+ *  is complete.
+ *
+ *  Once the length of the oldest packet is known, all later ones are
+ *  inside it, so only its CRC is updated until it is complete. Only if
+ *  it is bad, the others are recalculated (see lcnFramerCatchUp). In
+ *  sync, the work per byte is one CRC step.
+ */
+void lcnFramerByte(struct lcnFramer_s *f, unsigned char inByte)
+{
+  struct lcnCand_s *c;
+  unsigned char *b;
+  int i,n;
+
+  if (f->len == LCN_FRAME_MAX) lcnFramerDrop(f, 1); /* can not happen */
+
+  i = (f->head + f->len) & (LCN_FRAME_RING - 1);
+  f->buf[i] = inByte;
+  f->buf[i + LCN_FRAME_RING] = inByte;
+  c = &f->cand[i];
+  c->crc = 0;
+  c->expLen = 0;
+  c->state = LCN_CAND_PENDING;
+  f->len++;
+
+  b = &f->buf[f->head];
+  if (f->lazy)
+    {
+      lcnFramerCandStep(&f->cand[f->head], b, f->len);
+    }
+  else
+    {
+      for (i=0; i<f->len; i++)
+	{
+	  lcnFramerCandStep(&f->cand[(f->head + i) & (LCN_FRAME_RING - 1)], &b[i], f->len - i);
+	}
+    }
+
+  c = &f->cand[f->head];
+  if (c->state == LCN_CAND_PENDING) f->lazy = (c->expLen != 0);
+  else if (c->state == LCN_CAND_BAD && f->lazy) lcnFramerCatchUp(f);
+
+  /* let the oldest possible packet decide */
+
+  while (f->len > 0)
+    {
+      c = &f->cand[f->head];
+      if (c->state == LCN_CAND_PENDING)
+	{
+	  /* a packet of unknown type gives way to a complete known one */
+	  if (c->expLen != 0 || f->len < 2) break;
+	  for (i=1; i<f->len; i++)
+	    {
+	      n = (f->head + i) & (LCN_FRAME_RING - 1);
+	      if (f->cand[n].state == LCN_CAND_OK && f->cand[n].expLen != 0) break;
+	    }
+	  if (i == f->len) break;
+	  c->state = LCN_CAND_BAD;
+	}
+
+      if (c->state == LCN_CAND_OK)
+	{
+	  n = c->len;
+	  f->frames++;
+	  f->lost = 0;
+	  lcnFramerJunkFlush(f);
+	  f->pak(&f->buf[f->head], n);
+	  lcnFramerDrop(f, n);
+	  continue;
+	}
+
+      if (!f->lost)
+	{
+	  /* only the first failure counts, the following bytes are garbage */
+	  if (c->expLen != 0) f->crcErrors++;
+	  f->lost = 1;
+	  f->resyncs++;
+	  if (f->verbose)
+	    {
+	      printf("LCN receive error, resyncing (%lu CRC errors, %lu resyncs)\n",
+		     f->crcErrors, f->resyncs);
+	    }
+	}
+      f->garbage++;
+      if (f->junkLen == LCN_FRAME_MAX) lcnFramerJunkFlush(f);
+      f->junkBuf[f->junkLen++] = f->buf[f->head];
+      lcnFramerDrop(f, 1);
+    }
+}
+
+
+/*! \brief pass dropped bytes and bytes of an incomplete packet to the junk function
+ *  \param f pointer to framer
+ *  \return N/A
+ *
+ *  Used when the bus has been idle for a while, so the bytes will not
+ *  be completed anymore.
+ */
+void lcnFramerFlush(struct lcnFramer_s *f)
+{
+  lcnFramerJunkFlush(f);
+  if (f->len == 0) return;
+
+  f->garbage += f->len;
+  f->junk(&f->buf[f->head], f->len);
+  lcnFramerReset(f);
+}
@@ -27,85 +27,243 @@ with this program; if not, see <http://www.gnu.org/licenses/>.
 #include <sys/ioctl.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 
 #include "yali.h"
 
+int lcnSendAllowed(struct lcnSlot_s *p);
+
 /*! \brief temporary buffer for assembling LCN packets */
 unsigned char _yaliBuf[2512];
 
+/*! \brief statistics of the serial port */
+struct lcnSerStat_s _lcnSerStat;
+
+/*! \brief bytes waiting to be written to the LCN-PK */
+struct lcnTx_s _lcnTx;
+
+/*! \brief transport used to reach the LCN bus */
+struct lcnTrans_s *_lcnTrans = &_lcnTransSerial;
+
+/*! \brief framer for data received from the LCN-PK */
+struct lcnFramer_s _lcnRx;
+
 /*! \brief storage for LCN-PK (serial device) file descriptor */
 int _lcnSerFd = 0;
 
-/*! \brief structure used for queueing outgoing LCN packets */
-struct lcnQueue_s
+/*! \brief priority lanes of the LCN send queue */
+struct lcnRing_s _lcnSendQueue[LCN_PRIO_NUM];
+
+/*! \brief sent packets waiting for an ack (at most one per module) */
+struct lcnAcq_s _lcnSendAcq[LCN_ACQ_WIN];
+
+/*! \brief ack statistics per destination module */
+struct lcnMod_s _lcnMod[256];
+
+/*! \brief number of packets sent from higher lanes while polls were waiting */
+int _lcnSendPollSkip = 0;
+
+/*! \brief 1 while packets are collected by lcnQueueBatchBegin */
+int _lcnBatch = 0;
+
+/*! \brief time (see evTimeGet) the bus is expected to be idle again */
+double _lcnBusFree = 0.0;
+
+/*! \brief timer used to send the next packet as soon as the bus is idle */
+struct evTimer_s _lcnSendTimer;
+
+/*! \brief 1 if packets are sent by _lcnSendTimer (see lcnSendInit) */
+int _lcnSendInit = 0;
+
+/*! \brief sequence number + 1 of queued user packet per destination and command (0 = none) */
+unsigned long _lcnCoalesce[256][LCN_COAL_CMDS];
+
+
+/*! \brief replace queued user command for the same destination and output
+ *  \param q pointer to user lane
+ *  \param data pointer to LCN packet (8 bytes, without ACK)
+ *  \return 1:queued packet has been rewritten, 0:packet has to be queued
+ *
+ *  Only the latest value is relevant if a client sends several commands
+ *  for the same output before they have been sent to the bus. Only
+ *  absolute sets are coalesced (see LCN_COAL_OK).
+ */
+int lcnQueueCoalesce(struct lcnRing_s *q, unsigned char *data)
 {
-  int len;                 /*!<\brief total length of the LCN packet */
-  unsigned char *data;     /*!<\brief pointer to LCN packet data */
-  struct lcnQueue_s *next; /*!<\brief pointer to next packet in queue */
-};
+  struct lcnSlot_s *sp;
+  unsigned long *ip;
+  unsigned long n;
 
-/*! \brief pointer to root of queue for outgoing LCN packets */
-struct lcnQueue_s *_lcnSendQueue = NULL;
+  ip = &_lcnCoalesce[data[4]][data[5]];
+  n = q->num + q->pending;
 
-/*! \brief pointer to last unacknowledged packet */
-struct lcnQueue_s *_lcnSendAcqWait = NULL;
+  if (*ip != 0 && *ip - 1 >= q->seq && *ip - 1 < q->seq + n)
+    {
+      sp = &q->slot[(q->head + (*ip - 1 - q->seq)) % LCN_QUEUE_LEN];
+      if (sp->len == 8 && sp->data[4] == data[4] && sp->data[5] == data[5])
+	{
+	  memcpy(sp->data, data, 8);
+	  q->coalesced++;
+	  if (_conf.showLcnTraffic)
+	    {
+	      printf("LCN queued command for M%i/%i replaced (%lu replaced)\n",
+		     data[4], data[5], q->coalesced);
+	    }
+	  return 1;
+	}
+    }
 
-/*! \brief count how often a packet has been send without ack */
-int _lcnSendRepCount = 0;
+  return 0;
+}
 
 
 /*! \brief function used to queue a LCN packet into a queue
- *  \param pproot pointer to pointer to root of queue to add to
+ *  \param q pointer to queue to add to
  *  \param len length of LCN packet to add to queue
  *  \param data pointer to LCN packet to add to queue
- *  \return N/A
+ *  \return 0:OK, -1:packet refused (queue full or packet too long)
+ *
+ *  While a batch is collected, the packet is not visible to lcnQueueGet
+ *  until lcnQueueBatchEnd is called.
  */
-void lcnQueueAdd(struct lcnQueue_s **pproot, int len, unsigned char *data)
+int lcnQueueAdd(struct lcnRing_s *q, int len, unsigned char *data)
 {
-  struct lcnQueue_s *pnew;
-  struct lcnQueue_s *ptmp;
+  struct lcnSlot_s *sp;
+  int coal;
 
-  pnew = (struct lcnQueue_s*) malloc(sizeof(struct lcnQueue_s));
-  if (pnew == NULL)
+  coal = (q == &_lcnSendQueue[LCN_PRIO_USER] && LCN_COAL_OK(len, data));
+
+  if (coal && lcnQueueCoalesce(q, data)) return 0;
+
+  if (q == &_lcnSendQueue[LCN_PRIO_USER] && !coal && len >= 6)
     {
-      fprintf(stderr, "out of memory allocationg queue element\n");
-      exit(1);
+      /* later sets must not overtake this command by rewriting older ones */
+      memset(_lcnCoalesce[data[4]], 0, sizeof(_lcnCoalesce[0]));
     }
 
-  pnew->data = (unsigned char*) malloc(len);
-  if (pnew->data == NULL)
+  if (len > LCN_SLOT_SIZE || q->num + q->pending == LCN_QUEUE_LEN)
     {
-      fprintf(stderr, "out of memory allocationg data for queue\n");
-      exit(1);
+      q->drops++;
+      if (_conf.showLcnTraffic)
+	{
+	  printf("LCN send queue full, packet dropped (%i dropped)\n", q->drops);
+	}
+      return -1;
     }
 
-  memcpy(pnew->data, data, len);
+  /* remember position of the packet for coalescing */
+  if (coal) _lcnCoalesce[data[4]][data[5]] = q->seq + q->num + q->pending + 1;
 
-  pnew->len = len;
-  pnew->next = NULL;
+  sp = &q->slot[(q->head + q->num + q->pending) % LCN_QUEUE_LEN];
+  memcpy(sp->data, data, len);
+  sp->len = len;
+  sp->tick = _tick;
 
-  ptmp = *pproot;
-  if (ptmp==NULL)
+  if (_lcnBatch)
     {
-      *pproot = pnew;
+      q->pending++;
     }
   else
     {
-      while (ptmp->next)
-	{
-	  ptmp = ptmp->next;
-	}
-      ptmp->next = pnew;
+      q->num++;
+      lcnSendKick();
+    }
+
+  return 0;
+}
+
+
+/*! \brief start collecting packets for the send queue in a batch
+ *  \return N/A
+ *
+ *  Packets added to the send queue until lcnQueueBatchEnd is called
+ *  become visible to the sender in one step.
+ */
+void lcnQueueBatchBegin(void)
+{
+  assert(_lcnBatch == 0);
+
+  _lcnBatch = 1;
+}
+
+
+/*! \brief release all packets collected since lcnQueueBatchBegin
+ *  \return N/A
+ */
+void lcnQueueBatchEnd(void)
+{
+  int i;
+
+  assert(_lcnBatch == 1);
+
+  for (i=0; i<LCN_PRIO_NUM; i++)
+    {
+      _lcnSendQueue[i].num += _lcnSendQueue[i].pending;
+      _lcnSendQueue[i].pending = 0;
+    }
+  _lcnBatch = 0;
+
+  lcnSendKick();
+}
+
+
+/*! \brief number of packets waiting in the send queue
+ *  \return number of packets (all lanes)
+ */
+int lcnQueueDepth(void)
+{
+  int i;
+  int n;
+
+  n = 0;
+  for (i=0; i<LCN_PRIO_NUM; i++)
+    {
+      n += _lcnSendQueue[i].num + _lcnSendQueue[i].pending;
     }
+
+  return n;
+}
+
+
+/*! \brief number of packets a lane can still take
+ *  \param inPrio lane (LCN_PRIO_xxx)
+ *  \return number of free slots
+ */
+int lcnQueueFree(int inPrio)
+{
+  struct lcnRing_s *q;
+
+  assert(inPrio >= 0 && inPrio < LCN_PRIO_NUM);
+
+  q = &_lcnSendQueue[inPrio];
+  return LCN_QUEUE_LEN - q->num - q->pending;
 }
 
 
-void lcnQueueCommandSend(int inFd, int inDest, int inCmd, int inP1, int inP2)
+/*! \brief queue standard 8 byte LCN command packet
+ *  \param inFd file descriptor for serial device (unused)
+ *  \param inDest destination LCN module
+ *  \param inCmd LCN command byte
+ *  \param inP1 parameter byte 1 for command
+ *  \param inP2 parameter byte 2 for command
+ *  \param inPrio lane (LCN_PRIO_xxx)
+ *  \return 0:OK, -1:queue full
+ *
+ *  Commands are sent with ack and repeated until the module has
+ *  acknowledged (see lcnSendNext). Status polls are not, the status
+ *  report is their answer.
+ */
+int lcnQueueCommandSend(int inFd, int inDest, int inCmd, int inP1, int inP2, int inPrio)
 {
   unsigned char buf[8];
 
+  assert(inPrio >= 0 && inPrio < LCN_PRIO_NUM);
+
   buf[0] = 0x80;
-  buf[1] = 0x04; /* 4 = without ACK,  5 = wait for ACK */
+  buf[1] = (inPrio == LCN_PRIO_POLL) ? 0x04 : 0x05; /* 4 = without ACK,  5 = wait for ACK */
   buf[3] = 0x00;
   buf[4] = inDest;
   buf[5] = inCmd;
@@ -113,40 +271,153 @@ void lcnQueueCommandSend(int inFd, int inDest, int inCmd, int inP1, int inP2)
   buf[7] = inP2;
   buf[2] = lcnCrcCalc(buf, 8);
 
-  lcnQueueAdd(&_lcnSendQueue, 8, buf);
+  return lcnQueueAdd(&_lcnSendQueue[inPrio], 8, buf);
 }
 
-void lcnQueueCmdAdd(struct lcnPak_s *pk, int len)
+int lcnQueueCmdAdd(struct lcnPak_s *pk, int len, int inPrio)
 {
-  lcnQueueAdd(&_lcnSendQueue, len, (unsigned char*)pk);
+  assert(inPrio >= 0 && inPrio < LCN_PRIO_NUM);
+
+  return lcnQueueAdd(&_lcnSendQueue[inPrio], len, (unsigned char*)pk);
 }
 
-/*! \brief function used to remove and return first packet of a queue
- *  \param pproot pointer to pointer to root of queue to read from
- *  \return pointer to queue elemen that has been removed from the queue (NULL) if none
+/*! \brief function used to remove the first packet of a queue that may be sent
+ *  \param q pointer to queue to read from
+ *  \param sp pointer to slot the packet is copied to
+ *  \param outAcq result of lcnSendAllowed for the removed packet
+ *  \return 1:packet removed, 0:queue empty or all packets have to wait
+ *
+ *  Packets to modules that have not acknowledged yet stay in the queue,
+ *  so they keep their order without blocking packets to other modules.
+ *  The packets in front of the removed one move up by one slot.
  */
-struct lcnQueue_s * lcnQueueGet(struct lcnQueue_s **pproot)
+int lcnQueueGet(struct lcnRing_s *q, struct lcnSlot_s *sp, int *outAcq)
 {
-  struct lcnQueue_s *ptmp;
+  struct lcnSlot_s *p;
+  unsigned long *ip;
+  unsigned long wait;
+  int acq;
+  int n;
+  int i;
 
-  ptmp = *pproot;
-  if (ptmp!=NULL)
+  acq = -1;
+  for (n=0; n<q->num; n++)
     {
-      *pproot = ptmp->next;
+      acq = lcnSendAllowed(&q->slot[(q->head + n) % LCN_QUEUE_LEN]);
+      if (acq >= 0) break;
     }
+  if (acq < 0) return 0;
+
+  *sp = q->slot[(q->head + n) % LCN_QUEUE_LEN];
+  *outAcq = acq;
 
-  return ptmp;
+  for (i=n; i>0; i--)
+    {
+      p = &q->slot[(q->head + i) % LCN_QUEUE_LEN];
+      *p = q->slot[(q->head + i - 1) % LCN_QUEUE_LEN];
+
+      /* keep the position for coalescing up to date (see lcnQueueAdd) */
+      if (q == &_lcnSendQueue[LCN_PRIO_USER] && LCN_COAL_OK(p->len, p->data))
+	{
+	  ip = &_lcnCoalesce[p->data[4]][p->data[5]];
+	  if (*ip == q->seq + i) (*ip)++;
+	}
+    }
+
+  q->head = (q->head + 1) % LCN_QUEUE_LEN;
+  q->seq++;
+  q->num--;
+
+  wait = _tick - sp->tick;
+  q->sent++;
+  q->waitSum += wait;
+  if (wait > q->waitMax) q->waitMax = wait;
+
+  return 1;
+}
+
+
+/*! \brief remove next packet to send from the priority lanes
+ *  \param sp pointer to slot the packet is copied to
+ *  \param outAcq result of lcnSendAllowed for the packet
+ *  \return number of lane the packet was taken from, -1 if no packet may
+ *          be sent
+ *
+ *  Lanes are served by strict priority, except that background polls get
+ *  one turn after LCN_POLL_STARVE packets from higher lanes, so they are
+ *  not starved completely.
+ */
+int lcnQueueNext(struct lcnSlot_s *sp, int *outAcq)
+{
+  int i;
+
+  if (_lcnSendPollSkip >= LCN_POLL_STARVE
+      && lcnQueueGet(&_lcnSendQueue[LCN_PRIO_POLL], sp, outAcq))
+    {
+      _lcnSendPollSkip = 0;
+      return LCN_PRIO_POLL;
+    }
+
+  for (i=0; i<LCN_PRIO_NUM; i++)
+    {
+      if (lcnQueueGet(&_lcnSendQueue[i], sp, outAcq))
+	{
+	  if (i == LCN_PRIO_POLL) _lcnSendPollSkip = 0;
+	  else if (_lcnSendQueue[LCN_PRIO_POLL].num > 0) _lcnSendPollSkip++;
+	  return i;
+	}
+    }
+
+  return -1;
+}
+
+
+/*! \brief termios constant of a baud rate
+ *  \param inBaud baud rate
+ *  \return speed constant, B0 if not supported
+ */
+speed_t lcnBaudGet(int inBaud)
+{
+  switch (inBaud)
+    {
+    case 1200:   return B1200;
+    case 2400:   return B2400;
+    case 4800:   return B4800;
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+#ifdef B57600
+    case 57600:  return B57600;
+#endif
+#ifdef B115200
+    case 115200: return B115200;
+#endif
+    }
+
+  return B0;
 }
 
 
 /*! \brief function to open the serial device for communication with LCN-PK
  *  \return file descriptor for serial interface
+ *
+ *  The port is set to raw mode with _conf.lcnBaud baud, 8N1. VMIN
+ *  (limited to LCN_VMIN_MAX) decides how many bytes the driver collects
+ *  before the port becomes readable. VTIME is always 0: the port is
+ *  read non-blocking from the event loop, where an inter-byte timeout
+ *  has no effect. If _conf.lcnLowLatency is set, the driver is
+ *  asked not to delay received data (Linux only, ignored if the
+ *  driver does not support it).
  */
 int open_lcnport(void)
 {
   int fd;
   int status;
   struct termios options;
+  speed_t speed;
+#ifdef TIOCGSERIAL
+  struct serial_struct ser;
+#endif
 
   if (_conf.lcnInterface==NULL || *_conf.lcnInterface==0)
     {
@@ -155,6 +426,13 @@ int open_lcnport(void)
       return 0;
     }
 
+  speed = lcnBaudGet(_conf.lcnBaud);
+  if (speed == B0)
+    {
+      fprintf(stderr, "open_port: baud rate %i not supported\n", _conf.lcnBaud);
+      return -1;
+    }
+
   fd = open(_conf.lcnInterface, O_RDWR | O_NOCTTY | O_NDELAY);
   if (fd == -1)
   {
@@ -164,8 +442,8 @@ int open_lcnport(void)
 
   tcgetattr(fd, &options);
 
-  cfsetispeed(&options, B9600);
-  cfsetospeed(&options, B9600);
+  cfsetispeed(&options, speed);
+  cfsetospeed(&options, speed);
 
   options.c_cflag |= (CLOCAL | CREAD);
   options.c_cflag &= ~PARENB;
@@ -175,13 +453,32 @@ int open_lcnport(void)
   options.c_iflag &= ~(IXON | IXOFF | IXANY);
   options.c_cflag &= ~CRTSCTS;
 
+  /* raw mode: no line editing, no character translation */
+  options.c_lflag &= ~(ICANON | ECHO | ECHOE | ECHONL | ISIG | IEXTEN);
+  options.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL);
+  options.c_oflag &= ~OPOST;
+
+  options.c_cc[VMIN]  = (_conf.lcnVmin > LCN_VMIN_MAX) ? LCN_VMIN_MAX : _conf.lcnVmin;
+  options.c_cc[VTIME] = 0;
+
   tcsetattr(fd, TCSANOW, &options);
 
+#ifdef TIOCGSERIAL
+  if (ioctl(fd, TIOCGSERIAL, &ser) == 0)
+    {
+      if (_conf.lcnLowLatency) ser.flags |= ASYNC_LOW_LATENCY;
+      else ser.flags &= ~ASYNC_LOW_LATENCY;
+      ioctl(fd, TIOCSSERIAL, &ser);
+    }
+#endif
+
   ioctl(fd, TIOCMGET, &status);  
   status &= ~TIOCM_DTR;
   ioctl(fd, TIOCMSET, status);
 
-  fcntl(fd, F_SETFL, 0);
+  /* keep the descriptor non-blocking: the event loop is edge triggered
+     and lcnSerDataGet reads until no more data is available */
+  fcntl(fd, F_SETFL, O_NONBLOCK);
 
   _lcnSerFd = fd;
 
@@ -189,43 +486,118 @@ int open_lcnport(void)
 }
 
 
-/*! \brief subfunction for calculation LCN CRC bytes
- *  \param x new data byte to add
- *  \param store CRC calculated so far
- *  \return new CRC value
+/*! \brief print statistics of the serial port
+ *  \return N/A
+ *
+ *  Wakeups per telegram show how well VMIN and the driver match
+ *  the packet sizes: 1.0 means one wakeup per LCN packet.
  */
-int lcnCrcStep(int x, int store)
-{ 
-  int c; 
-  int new = x + store; 
+void lcnSerStatPrint(void)
+{
+  printf("LCN serial: %lu wakeups, %lu reads, %lu bytes, %lu telegrams",
+	 _lcnSerStat.wakeups, _lcnSerStat.reads, _lcnSerStat.bytes, _lcnRx.frames);
+  if (_lcnRx.frames > 0)
+    {
+      printf(" (%.2f wakeups/telegram)",
+	     (double) _lcnSerStat.wakeups / _lcnRx.frames);
+    }
+  printf("\n");
+  printf("LCN serial: %lu bytes written, %lu stalls, %lu dropped\n",
+	 _lcnSerStat.txBytes, _lcnSerStat.txStalls, _lcnSerStat.txDrops);
+}
 
-  c = (( new & 0x7f ) << 2 ) | (( new & 0x180 ) >> 7 ); 
-  if ( c > 0xff ) { c = c-0xff; } 
 
-  return c;
-} 
+/*! \brief write as many bytes of the transmit ring as the driver takes
+ *  \param inFd file descriptor for serial device
+ *  \return N/A
+ *
+ *  Never blocks. If bytes are left, EV_WRITE is requested and the
+ *  function is called again by yaliSerEvent once the port is writable.
+ */
+void lcnTxFlush(int inFd)
+{
+  int n;
+  int ret;
 
+  while (_lcnTx.len > 0)
+    {
+      n = LCN_TX_BUF - _lcnTx.head;
+      if (n > _lcnTx.len) n = _lcnTx.len;
 
-/*! \brief function for calculation LCN CRC bytes
- *  \param data pointer to LCN packet
- *  \param len length of LCN packet
- *  \return calculated CRC value
+      ret = write(inFd, &_lcnTx.buf[_lcnTx.head], n);
+      if (ret < 0)
+	{
+	  if (errno == EINTR) continue;
+	  if (errno == EAGAIN || errno == EWOULDBLOCK)
+	    {
+	      _lcnSerStat.txStalls++;
+	      break;
+	    }
+
+	  perror("writing to LCN interface");
+	  _lcnTx.len = 0;
+	  break;
+	}
+
+      _lcnSerStat.txBytes += ret;
+      _lcnTx.head = (_lcnTx.head + ret) & (LCN_TX_BUF - 1);
+      _lcnTx.len -= ret;
+    }
+
+  /* the fd is registered by main() before lcnSendInit is called */
+  if (_lcnSendInit && _lcnTx.waiting != (_lcnTx.len > 0))
+    {
+      _lcnTx.waiting = (_lcnTx.len > 0);
+      evFdMod(inFd, _lcnTx.waiting ? (EV_READ | EV_WRITE) : EV_READ);
+    }
+}
+
+
+/*! \brief add bytes to the transmit ring and start writing them
+ *  \param inFd file descriptor for serial device
+ *  \param data pointer to bytes
+ *  \param inLen number of bytes
+ *  \return 0:OK, -1:ring full (nothing added)
  */
-unsigned char lcnCrcCalc(unsigned char *data, int len)
-{ 
-  int crc = 0; 
-  int count; 
+int lcnTxPut(int inFd, unsigned char *data, int inLen)
+{
+  int i;
 
-  for (count = 0; count < len;count++)
-    {       
-      if ( count != 2 )
-        {
-          crc = lcnCrcStep(data[count], crc); 
-        } 
+  if (_lcnTx.len + inLen > LCN_TX_BUF)
+    {
+      _lcnSerStat.txDrops++;
+      return -1;
     }
 
-  return crc;
-}  
+  for (i=0; i<inLen; i++)
+    {
+      _lcnTx.buf[(_lcnTx.head + _lcnTx.len) & (LCN_TX_BUF - 1)] = data[i];
+      _lcnTx.len++;
+    }
+
+  lcnTxFlush(inFd);
+  return 0;
+}
+
+
+/*! \brief number of bytes that have not left the UART yet
+ *  \param inFd file descriptor for serial device
+ *  \return bytes in the transmit ring plus bytes in the driver's output queue
+ *
+ *  The output queue is read with TIOCOUTQ, drivers not supporting it
+ *  count as empty.
+ */
+int lcnTxPending(int inFd)
+{
+  int n;
+
+  n = 0;
+#ifdef TIOCOUTQ
+  if (!_conf.lcnInterface || ioctl(inFd, TIOCOUTQ, &n) != 0 || n < 0) n = 0;
+#endif
+
+  return n + _lcnTx.len;
+}
 
 
 /*! \brief function for queueing a single LCN packet for sending to serial interface
@@ -256,81 +628,425 @@ void lcnPakSend(int inFd, struct pak_s *p)
 
   _yaliBuf[2] = lcnCrcCalc(_yaliBuf, p->len + 1);
 
-  lcnQueueAdd(&_lcnSendQueue, p->len + 1, _yaliBuf);
+  lcnQueueAdd(&_lcnSendQueue[LCN_PRIO_USER], p->len + 1, _yaliBuf);
 }
 
 
-/*! \brief send the next LCN packet in the send-queue to the LCN-PK
- *  \param inFd file descriptor for serial device
+/*! \brief timer function sending the next LCN packet
+ *  \param inCtx unused
+ *  \return N/A
+ */
+void lcnSendTimerFunc(void *inCtx)
+{
+  lcnSendNext(_lcnSerFd);
+}
+
+
+/*! \brief let the event loop send LCN packets as soon as the bus is idle
  *  \return N/A
  *
- *  This function is to be called with a fixed rate, for example 10 Hz.
+ *  To be called once after the event loop and the serial interface
+ *  have been initialized. Before, packets are only queued.
  */
-void lcnSendNext(int inFd)
+void lcnSendInit(void)
+{
+  memset(&_lcnSendTimer, 0, sizeof(_lcnSendTimer));
+  _lcnSendInit = 1;
+
+  lcnTxFlush(_lcnSerFd);
+  lcnSendKick();
+}
+
+
+/*! \brief (re)start the send timer
+ *  \param inTime time (see evTimeGet) lcnSendNext is called
+ *  \return N/A
+ */
+void lcnSendArm(double inTime)
+{
+  double delay;
+
+  if (!_lcnSendInit) return;
+
+  delay = inTime - evTimeGet();
+  if (delay < 0.0) delay = 0.0;
+
+  evTimerStart(&_lcnSendTimer, delay, 0.0, lcnSendTimerFunc, NULL);
+}
+
+
+/*! \brief make sure the send timer runs if there is something to send
+ *  \return N/A
+ */
+void lcnSendKick(void)
+{
+  int i;
+
+  if (!_lcnSendInit) return;
+
+  /* the timer may wait for an overdue ack, an ack can free packets earlier */
+  if (_lcnSendTimer.active && _lcnSendTimer.due <= _lcnBusFree) return;
+
+  if (lcnQueueDepth() == 0)
+    {
+      for (i=0; i<LCN_ACQ_WIN; i++)
+	{
+	  if (_lcnSendAcq[i].used) break;
+	}
+      if (i == LCN_ACQ_WIN) return;
+    }
+
+  lcnSendArm(_lcnBusFree);
+}
+
+
+/*! \brief mark bus as busy
+ *  \param inBytes number of bytes that are (or have just been) on the bus
+ *  \param inSent 1: bytes are being sent now, 0: bytes have been received
+ *  \return N/A
+ *
+ *  The bus is considered idle LCN_GAP seconds after the last byte.
+ */
+void lcnBusUse(int inBytes, int inSent)
 {
-  struct lcnQueue_s *p;
-  int i,n;
+  double t;
+
+  t = evTimeGet() + LCN_GAP;
+  if (inSent) t += (double) inBytes * LCN_BYTE_BITS / _conf.lcnBaud;
+
+  if (t > _lcnBusFree) _lcnBusFree = t;
+}
+
+
+/*! \brief check whether a packet wants to be acknowledged
+ *  \param p pointer to slot holding the packet
+ *  \return 1:ack wanted, 0:no ack
+ */
+int lcnSlotWantsAck(struct lcnSlot_s *p)
+{
+  return (p->len >= 6) && (p->data[1] == 5);
+}
+
+
+/*! \brief find the unacknowledged packet sent to a module
+ *  \param inDst destination field of the LCN packet
+ *  \return index into _lcnSendAcq, -1 if none
+ */
+int lcnAcqFind(int inDst)
+{
+  int i;
+
+  for (i=0; i<LCN_ACQ_WIN; i++)
+    {
+      if (_lcnSendAcq[i].used
+	  && ((struct lcnPak_s*) _lcnSendAcq[i].slot.data)->dst == inDst)
+	{
+	  return i;
+	}
+    }
+
+  return -1;
+}
+
+
+/*! \brief check whether a packet may be sent now
+ *  \param p pointer to slot holding the packet
+ *  \return index of free _lcnSendAcq entry (LCN_ACQ_WIN if no ack is wanted),
+ *          -1 if the packet has to wait
+ *
+ *  A packet has to wait while an earlier one to the same module is not
+ *  acknowledged yet, or if it wants an ack and the window is full.
+ */
+int lcnSendAllowed(struct lcnSlot_s *p)
+{
+  int i;
+
+  if (p->len >= 6 && lcnAcqFind(((struct lcnPak_s*) p->data)->dst) >= 0)
+    {
+      return -1;
+    }
+
+  if (!lcnSlotWantsAck(p)) return LCN_ACQ_WIN;
+
+  for (i=0; i<LCN_ACQ_WIN; i++)
+    {
+      if (!_lcnSendAcq[i].used) return i;
+    }
+
+  return -1;
+}
+
+
+/*! \brief retransmit timeout for a packet waiting for an ack
+ *  \param inDst destination field of the LCN packet
+ *  \param inCount number of times the packet has been sent
+ *  \return timeout (s)
+ *
+ *  The base timeout is srtt + 4 * rttvar of the module (LCN_ACK_TIMEOUT as
+ *  long as nothing has been measured). It is doubled with every repetition
+ *  and stretched by a random jitter, so repeated packets to several
+ *  modules do not collide again and again.
+ */
+double lcnAckTimeout(int inDst, int inCount)
+{
+  struct lcnMod_s *mp;
+  double rto;
+  int i;
+
+  mp = &_lcnMod[inDst & 0xFF];
+
+  if (mp->srtt > 0.0) rto = mp->srtt + 4.0 * mp->rttvar;
+  else rto = LCN_ACK_TIMEOUT;
+  if (rto < LCN_RTO_MIN) rto = LCN_RTO_MIN;
+
+  for (i=1; i<inCount && rto < LCN_RTO_MAX; i++)
+    {
+      rto *= 2.0;
+    }
+  if (rto > LCN_RTO_MAX) rto = LCN_RTO_MAX;
+
+  return rto * (1.0 + LCN_RTO_JITTER * random() / (double) RAND_MAX);
+}
+
+
+/*! \brief update ack statistics of a module
+ *  \param ap entry of the packet that has been acknowledged or given up
+ *  \param inAcked 1:ack received, 0:packet could not be delivered
+ *  \return N/A
+ *
+ *  Only acks to packets that have been sent once are used to measure the
+ *  round trip time, since it is unknown which copy an ack belongs to.
+ */
+void lcnModUpdate(struct lcnAcq_s *ap, int inAcked)
+{
+  struct lcnMod_s *mp;
+  int dst;
+  double rtt;
+
+  dst = ((struct lcnPak_s*) ap->slot.data)->dst;
+  mp = &_lcnMod[dst];
+
+  if (!inAcked)
+    {
+      mp->fails++;
+      if (mp->fails >= LCN_SUSPECT && !mp->suspect)
+	{
+	  mp->suspect = 1;
+	  if (_conf.showLcnTraffic)
+	    {
+	      printf("LCN module %i does not answer, marked suspect\n", dst);
+	    }
+	}
+      return;
+    }
+
+  if (mp->suspect && _conf.showLcnTraffic)
+    {
+      printf("LCN module %i answers again\n", dst);
+    }
+  mp->fails = 0;
+  mp->suspect = 0;
+
+  if (ap->count != 1) return;
+
+  rtt = evTimeGet() - ap->sent;
+  if (rtt < 0.0) rtt = 0.0;
+
+  if (mp->srtt == 0.0)
+    {
+      mp->srtt = rtt;
+      mp->rttvar = rtt / 2.0;
+    }
+  else
+    {
+      mp->rttvar = 0.75 * mp->rttvar + 0.25 * fabs(mp->srtt - rtt);
+      mp->srtt = 0.875 * mp->srtt + 0.125 * rtt;
+    }
+}
+
+
+/*! \brief write one LCN packet to the bus (see _lcnTrans)
+ *  \param inFd file descriptor of the transport
+ *  \param p pointer to slot holding the packet
+ *  \param inLane lane the packet was taken from, -1 for repeated packets
+ *  \return 0:OK, -1:packet could not be sent
+ */
+int lcnSlotWrite(int inFd, struct lcnSlot_s *p, int inLane)
+{
+  int i;
+  int ahead;
   int ret;
 
-  if (_lcnSendAcqWait != NULL)
+  if (_conf.showLcnTraffic)
     {
-      _lcnSendRepCount++;
-      if (_lcnSendRepCount < 5) /* try it up to 5 times */
+      printf("LCN>>> %li ", _tick);
+      for (i=0; i<p->len; i++)
+	{
+	  printf(" %02X", p->data[i]);
+	}
+      if (inLane >= 0)
 	{
-	  p = _lcnSendAcqWait;
+	  printf(" (lane %i, waited %lu, %i queued)", inLane,
+		 _tick - p->tick, lcnQueueDepth());
 	}
       else
 	{
-	  /* error packet could not be delivered */
-	  free(p->data);
-	  p->data = NULL;
-	  free(p);
-
-	  _lcnSendAcqWait = NULL;
+	  printf(" (repeated)");
 	}
+      printf("\n");
     }
 
-  if (_lcnSendAcqWait == NULL)
+  /* bytes still queued in front of the packet delay it on the bus */
+  ahead = 0;
+  ret = 0;
+  if (_conf.lcnInterface)
+    {
+      ahead = _lcnTrans->pending(inFd);
+      ret = _lcnTrans->put(inFd, p->data, p->len);
+    }
+
+  /* without pacing, the bus use only marks the time the packet was sent */
+  lcnBusUse(_lcnTrans->paced ? ahead + p->len : 0, 1);
+  if (ret == 0) lcnLogPak(LCN_LOG_TX, p->data, p->len);
+
+  return ret;
+}
+
+
+/*! \brief send a new packet, remember it if it waits for an ack
+ *  \param inFd file descriptor for serial device
+ *  \param p pointer to slot holding the packet
+ *  \param inLane lane the packet was taken from (see lcnSlotWrite)
+ *  \param inAcq index of free _lcnSendAcq entry or LCN_ACQ_WIN (see lcnSendAllowed)
+ *  \return N/A
+ */
+void lcnSlotSend(int inFd, struct lcnSlot_s *p, int inLane, int inAcq)
+{
+  struct lcnAcq_s *ap;
+
+  if (lcnSlotWrite(inFd, p, inLane) == 0 && inAcq < LCN_ACQ_WIN)
+    {
+      ap = &_lcnSendAcq[inAcq];
+      ap->used = 1;
+      ap->slot = *p;
+      ap->count = 1;
+      ap->sent = _lcnBusFree - LCN_GAP;
+      ap->due = _lcnBusFree + lcnAckTimeout(ap->slot.data[4], 1);
+    }
+}
+
+
+/*! \brief send the next LCN packet in the send-queue to the LCN-PK
+ *  \param inFd file descriptor for serial device
+ *  \return N/A
+ *
+ *  Packets are sent back to back as long as the bus is idle, the time
+ *  a packet occupies the bus is calculated from its length and the baud
+ *  rate.
+ *
+ *  Up to LCN_ACQ_WIN packets to different modules may wait for their ack
+ *  at the same time. Each of them is repeated after a timeout derived
+ *  from the module's round trip time (see lcnAckTimeout) until
+ *  LCN_ACQ_TRIES attempts have failed. Packets to a module that has not
+ *  acknowledged yet stay in their lane and are skipped (see lcnQueueGet),
+ *  so traffic to other modules keeps flowing.
+ *  Modules that failed repeatedly are suspect: their packets are moved to
+ *  the poll lane and sent only once.
+ *
+ *  A packet is only handed to the driver when the previous one has left
+ *  the UART (see lcnTxPending), so a stalled adapter delays sending
+ *  instead of filling the transmit ring. Transports that are not paced
+ *  report only their transmit ring and kick the queue once it is empty.
+ */
+void lcnSendNext(int inFd)
+{
+  struct lcnSlot_s slot;
+  struct lcnAcq_s *ap;
+  int i;
+  int lane;
+  int acq;
+  double now;
+  double next;
+
+  now = evTimeGet();
+  if (now < _lcnBusFree)
     {
-      p = lcnQueueGet(&_lcnSendQueue);
-      _lcnSendRepCount =  0;
+      /* bus is busy (inbound traffic) */
+      lcnSendKick();
+      return;
+    }
 
-      if ( (p != NULL) && (p->len >= 6) && (p->data[1] == 5) )
+  i = _lcnTrans->pending(inFd);
+  if (i < 0)
+    {
+      /* transport not ready, it kicks the queue when it is */
+      return;
+    }
+  if (i > 0)
+    {
+      /* previous packet is still being transmitted */
+      if (_lcnTrans->paced)
 	{
-	  _lcnSendAcqWait = p;
+	  lcnBusUse(i, 1);
+	  lcnSendKick();
 	}
+      /* else the transport kicks the queue when its ring is empty */
+      return;
     }
 
-  if (p != NULL)
+  /* repeat packets whose ack is overdue */
+
+  next = 0.0;
+  for (i=0; i<LCN_ACQ_WIN; i++)
     {
-      if (_conf.showLcnTraffic)
+      ap = &_lcnSendAcq[i];
+      if (!ap->used) continue;
+
+      if (ap->due > now)
 	{
-	  printf("LCN>>> %li ", _tick);
-	  for (i=0; i<p->len; i++)
-	    {
-	      printf(" %02X", p->data[i]);
-	    }
-	  printf("\n");
+	  if (next == 0.0 || ap->due < next) next = ap->due;
+	  continue;
 	}
-      
-      if (_conf.lcnInterface)
+
+      if (ap->count >= LCN_ACQ_TRIES || _lcnMod[ap->slot.data[4]].suspect)
 	{
-	  n = 0;
-	  while (n < p->len)
-	    {
-	      ret = write(inFd, &p->data[n], p->len - n);
-	      if (ret < 0) break;
-	      n += ret;
-	    }
+	  /* error packet could not be delivered */
+	  lcnModUpdate(ap, 0);
+	  ap->used = 0;
+	  continue;
 	}
-      
-      if (_lcnSendAcqWait == NULL)
+
+      ap->count++;
+      lcnSlotWrite(inFd, &ap->slot, -1);
+      ap->sent = _lcnBusFree - LCN_GAP;
+      ap->due = _lcnBusFree + lcnAckTimeout(ap->slot.data[4], ap->count);
+
+      lcnSendKick();
+      return;
+    }
+
+  /* new packets */
+
+  for (;;)
+    {
+      lane = lcnQueueNext(&slot, &acq);
+      if (lane < 0) break;
+
+      /* packets to suspect modules are sent only when nothing else waits */
+      if (lane < LCN_PRIO_POLL && slot.len >= 6 && _lcnMod[slot.data[4]].suspect
+	  && lcnQueueAdd(&_lcnSendQueue[LCN_PRIO_POLL], slot.len, slot.data) == 0)
 	{
-	  free(p->data);
-	  p->data = NULL;
-	  free(p);
+	  continue;
 	}
+
+      lcnSlotSend(inFd, &slot, lane, acq);
+      lcnSendKick();
+      return;
     }
+
+  /* nothing to send before the next ack is overdue */
+
+  if (next != 0.0) lcnSendArm(next);
 }
 
 
@@ -348,7 +1064,7 @@ void lcnCommandSendTimed(unsigned long tm, int inFd, int inDest,
 
   pq->time       = tm;
   pq->lcn.src    = 0x80;
-  pq->lcn.info   = 0x04; /* 4 = without ACK,  5 = wait for ACK */
+  pq->lcn.info   = 0x05; /* 4 = without ACK,  5 = wait for ACK */
   pq->lcn.dstSeg = 0x00;
   pq->lcn.dst    = inDest;
   pq->lcn.cmd    = inCmd;
@@ -360,7 +1076,7 @@ void lcnCommandSendTimed(unsigned long tm, int inFd, int inDest,
 }
 
 /*! \brief send standard 8 byte LCN packet (create and add to send-queue)
- *  \param inFd file descriptor for serial device (unused)
+ *  \param inFd file descriptor for serial device
  *  \param inDest destination LCN module
  *  \param inCmd LCN command byte
  *  \paran inP1 parameter byte 1 for command 
@@ -370,8 +1086,6 @@ void lcnCommandSendTimed(unsigned long tm, int inFd, int inDest,
 void lcnCommandSend(int inFd, int inDest, int inCmd, int inP1, int inP2)
 {
   unsigned char buf[8];
-  int n;
-  int ret;
 
   buf[0] = 0x80;
   buf[1] = 0x05; /* 4 = without ACK,  5 = wait for ACK */
@@ -382,118 +1096,40 @@ void lcnCommandSend(int inFd, int inDest, int inCmd, int inP1, int inP2)
   buf[7] = inP2;
   buf[2] = lcnCrcCalc(buf, 8);
 
-  n = 0;
-  while (n<8)
-    {
-      ret = write(inFd, &buf[n], 8-n);
-      if (ret < 0) break;
-      n += ret;
-    }
+  _lcnTrans->put(inFd, buf, 8);
 }
 
 
-/*! \brief check if pointed data is a valid (and known) LCN packet
- *  \paran p pointer to packet data
- *  \paran inLen length of packet in bytes
- *  \return 0=crc-error, 1=unknown+crcOk, 2=incomplete, 3=valid, 4=known+crcError
+/*! \brief dump, log and broadcast received data without interpreting it
+ *  \param p pointer to received data
+ *  \param inLen length of data
+ *  \return N/A
  */
-int lcnPakVerify(unsigned char *p, int inLen)
+void lcnPakTrace(unsigned char *p, int inLen)
 {
-  int expLen;
-  struct lcnPak_s *lcn;
   int i;
-  int source;
-  int srcOk, dstOk;
-  struct lights_s *lp;
-
-  lcn = (struct lcnPak_s*) p;
-
-  if (inLen<3) return 2;
-
-  expLen = 0;
-  if (lcn->info == 0) expLen = 6;
-  else if (lcn->info >=4 && lcn->info <=7) expLen = 8;
-  else if (lcn->info == 8) expLen = 12;
-  else if (lcn->info == 74) expLen = 12;
-  else if (lcn->info == 12) expLen = 20;
-
-  source = 0;
-  for (i=1; i<256; i*=2)
-    {
-      source *= 2;
-      if ( (i & lcn->src)!=0 )
-	{
-	  source += 1;
-	}
-    }
-
-  srcOk = 0;
-  dstOk = 0;
-
-  lp = _lights;
-  while (lp)
-    {
-      if (source == lp->module) srcOk = 1;
-      if (lcn->dst == lp->module) dstOk = 1;
-      lp = lp->next;
-    }
 
-  if (source==1) srcOk = 1;
-  if (lcn->dst==1) dstOk = 1;
-
-  if (expLen!=0 || srcOk==0 || dstOk==0)
+  /* hex-dump of LCN packet */
+  if (_conf.showLcnTraffic)
     {
-      if (inLen<expLen) return 2;
-      if (lcnCrcCalc(p, expLen)==lcn->crc)
-	{
-	  return 3;
-	}
-      else
+      printf("LCN<<< ");
+      for (i=0; i<inLen; i++)
 	{
-	  return 4;
+	  printf(" %02X", p[i]);
 	}
+      printf("\n");
     }
 
-  if (lcnCrcCalc(p, inLen)==lcn->crc)
-    {
-      return 1;
-    }
-  else
+  /* print LCN packet in human readable format */
+  if (_conf.showLcnTraffic)
     {
-      return 0;
+      lcnPrint(p, inLen);
     }
-}
-
 
-/*! \brief check if pointed data contains a valid (and known) LCN packet
- *  \paran p pointer to received data block
- *  \paran inLen length of data block
- *  \return number of garbage bytes before start of packet
- */
-int lcnPakValidScan(unsigned char *p, int inLen)
-{
-  int start;
-  int len;
-  int ret;
+  /* append packet to binary log */
+  lcnLogPak(LCN_LOG_RX, p, inLen);
 
-  for (start=1; start<inLen; start++)
-    {
-      len = 1;
-      ret = 0;
-      while ( len<=(inLen-start) )
-	{
-	  ret = lcnPakVerify(&p[start], len);
-	  if (ret!=2) break;
-	  len++;
-	}
-
-      if (ret==3) return start;
-
-      /* valid CRC, typical length */
-      if (ret==1 && (len==6 || len==8 || len==12 || len==20)) return start;
-    }
-
-  return 0;
+  netRawBroadcast(p, inLen);
 }
 
 
@@ -508,89 +1144,37 @@ void lcnPakProc(unsigned char *p, int inLen)
   struct lcnPak_s *lcn;
   int tmp;
 
-  /* hex-dump of LCN packet */
-  if (_conf.showLcnTraffic)
-    {
-      printf("LCN<<< ");
-      for (i=0; i<inLen; i++)
-	{
-	  printf(" %02X", p[i]);
-	}
-      printf("\n");
-    }
+  lcnPakTrace(p, inLen);
 
   lcn = (struct lcnPak_s*) p;
 
-  /* print LCN packet in human readable format */
-  if (_conf.showLcnTraffic)
-    {
-      lcnPrint(p, inLen);
-    }
-
-  /* generate binary log file for this packet */
-  if (_conf.lcnBinLogBasename!=NULL)
-    {
-      static int pkcnt = 1;
-      FILE *fp;
-      char cbuf[256];
-
-      sprintf(cbuf, "%s_%04i.lcn", _conf.lcnBinLogBasename, pkcnt++);
-      fp = fopen(cbuf, "wb");
-      if (fp)
-	{
-	  for (i=0; i<inLen; i++)
-	    {
-	      fputc(p[i], fp);
-	    }
-	  fclose(fp);
-	}
-    }
-
   yaliTimeAdapt();
 
-  /* positive acknowledge to last command ? */
+  /* positive acknowledge to last command ? (acks are 6 bytes long) */
 
-  if (inLen==8 && lcn->info==0)
+  if (inLen==6 && lcn->info==0)
     {
       int source;
       int rdst;
       struct lcnPak_s *tc;
 
-      source = 0;
-      rdst = 0;
-      for (i=1; i<256; i*=2)
-	{
-	  source *= 2;
-	  if ( (i & lcn->src)!=0 )
-	    {
-	      source += 1;
-	    }
-
-	  rdst *= 2;
-	  if ( (i & lcn->dst)!=0 )
-	    {
-	      rdst += 1;
-	    }
-	}
+      source = _lcnBitRev[lcn->src];
+      rdst = _lcnBitRev[lcn->dst];
 
       /*printf("ACK: from M%i to M%i\n", source, lcn->dst);*/
 
-      if (_lcnSendAcqWait != NULL)
+      i = lcnAcqFind(source);
+      if (i >= 0)
 	{
-	  tc = (struct lcnPak_s*) _lcnSendAcqWait->data;
+	  tc = (struct lcnPak_s*) _lcnSendAcq[i].slot.data;
 
-	  if ( (tc->dst == source)
-	       && (tc->src == rdst) )
+	  if (tc->src == rdst)
 	    {
-	      /* got positive ack to last sent command */
-
-	      free(_lcnSendAcqWait->data);
-	      _lcnSendAcqWait->data = NULL;
+	      /* got positive ack to a sent command */
 
-	      free(_lcnSendAcqWait);
-	      _lcnSendAcqWait = NULL;
-
-	      _lcnSendRepCount = 0;
+	      lcnModUpdate(&_lcnSendAcq[i], 1);
+	      _lcnSendAcq[i].used = 0;
+	      lcnSendKick();
 	    }
 	}
     }
@@ -602,15 +1186,7 @@ void lcnPakProc(unsigned char *p, int inLen)
     {
       int source;
 
-      source = 0;
-      for (i=1; i<256; i*=2)
-	{
-	  source *= 2;
-	  if ( (i & lcn->src)!=0 )
-	    {
-	      source += 1;
-	    }
-	}
+      source = _lcnBitRev[lcn->src];
 
       stateLightUpdate(source, 1, p[8]/2);
       stateLightUpdate(source, 2, p[11]/2);
@@ -690,79 +1266,73 @@ void lcnPakProc(unsigned char *p, int inLen)
     }
 }
 
-/*! \brief read arbitrary number of bytes from serial interface
+/*! \brief read all available bytes from serial interface
  *  \paran inFd file descriptor to read from 
  *  \return N/A
  *
  *  As soon as a LCN packet is completed, the funciton lcnPakProc
- *  is called further to process the received packet.
+ *  is called further to process the received packet. The interface
+ *  is read until no more data is available (edge triggered event loop).
  */
 void lcnSerDataGet(int inFd)
 {
-  static unsigned char rcbuf[128];
-  static int rcpos = 0;
-  static int ckpos = 0;
+  static unsigned char rcbuf[LCN_RX_BUF];
   static unsigned long ltime = 0;
   unsigned long ntime;
   int i;
   int ret;
+  int got;
 
-  if (rcpos >= 128)
+  got = 0;
+  while (1)
     {
-      /* buffer full of garbage - flush and start over from 0 */
-      rcpos = 0;
-      ckpos = 0;
-      /*printf("LCN receive buffer with 128 bytes flushed\n");*/
-    }
+      ntime = _tick;
+      if ( (ntime - ltime)>1 )
+	{
+	  /*printf("flush old unknown data\n");*/
+	  lcnFramerFlush(&_lcnRx);
+	}
+      ltime = ntime;
 
-  ntime = _tick;
-  if ( (ntime - ltime)>1 && rcpos!=0 )
-    {
-      /*printf("flush old unknown data\n");*/
-      lcnPakProc(rcbuf, rcpos);
-      rcpos = 0;
-      ckpos = 0;
-    }
-  ltime = ntime;
+      ret = read(inFd, rcbuf, sizeof(rcbuf));
+      /*printf("input from LCN (%i bytes)\n", ret);*/
 
-  ret = read(inFd, &rcbuf[rcpos], 128 - rcpos);
-  /*printf("input from LCN (%i bytes)\n", ret);*/
+      if (ret <= 0) break;
 
-  if (ret > 0)
-    {
-      rcpos += ret;
-      
-      while (ckpos < rcpos)
-	{
-	  ckpos++;
-	  ret = lcnPakVerify(rcbuf, ckpos);
+      if (!got) _lcnSerStat.wakeups++;
+      got = 1;
+      _lcnSerStat.reads++;
+      _lcnSerStat.bytes += ret;
 
-	  if (ret==2) continue; /* incomplete */
+      lcnBusUse(ret, 0);
 
-	  if (ret==3) /* known + crcOk */
-	    {
-	      lcnPakProc(rcbuf, ckpos);
-	      for (i=ckpos; i<rcpos; i++)
-		{
-		  rcbuf[i-ckpos] = rcbuf[i];
-		}
-	      rcpos -= ckpos;
-	      ckpos = 0;
-	      continue;
-	    }
-
-	  ret = lcnPakValidScan(rcbuf, ckpos);
-	  if (ret!=0)
-	    {
-	      /*printf("lcnPakValidScan returned %i\n", ret);*/
-	      lcnPakProc(rcbuf, ret);
-	      for (i=ret; i<rcpos; i++)
-		{
-		  rcbuf[i-ret] = rcbuf[i];
-		}
-	      ckpos -= ret;
-	      rcpos -= ret;
-	    }
+      for (i=0; i<ret; i++)
+	{
+	  lcnFramerByte(&_lcnRx, rcbuf[i]);
 	}
     }
 }
+
+
+/*! \brief event handler of the serial transport
+ *  \param inFd file descriptor for serial device
+ *  \param inEvents EV_READ, EV_WRITE, EV_ERROR
+ *  \return N/A
+ */
+void lcnSerEvent(int inFd, int inEvents)
+{
+  if (inEvents & EV_WRITE) lcnTxFlush(inFd);
+  if (inEvents & (EV_READ | EV_ERROR)) lcnSerDataGet(inFd);
+}
+
+
+/*! \brief LCN-PK at a serial port */
+struct lcnTrans_s _lcnTransSerial =
+  {
+    "LCN-PK",
+    open_lcnport,
+    lcnTxPut,
+    lcnTxPending,
+    lcnSerEvent,
+    1
+  };
@@ -33,23 +33,235 @@ struct lcnPak_s
   unsigned char p2;     /*!<\brief second command paramter */
 };
 
+/*! \brief max. length of a LCN packet on the bus */
+#define LCN_FRAME_MAX  20
+
+/*! \brief size of the receive framer ring (power of 2, >= LCN_FRAME_MAX) */
+#define LCN_FRAME_RING 32
+
+/* state of a possible LCN packet in the receive framer */
+
+#define LCN_CAND_PENDING 0 /* not complete yet */
+#define LCN_CAND_OK      1 /* complete with valid CRC */
+#define LCN_CAND_BAD     2 /* CRC error or no valid length */
+
+/*! \brief possible LCN packet starting at one position of the framer buffer */
+struct lcnCand_s
+{
+  int crc;                 /*!<\brief CRC of the bytes received so far */
+  int expLen;              /*!<\brief expected length (0 if unknown) */
+  int len;                 /*!<\brief length when complete */
+  int state;               /*!<\brief LCN_CAND_xxx */
+};
+
+/*! \brief callback of a framer for received packets or dropped bytes */
+typedef void (*lcnFrameFunc_t)(unsigned char *p, int inLen);
+
+/*! \brief incremental splitter of received bytes into LCN packets
+ *
+ *  buf and cand are rings starting at head. Each byte is stored twice,
+ *  LCN_FRAME_RING bytes apart, so the bytes from head on are contiguous.
+ */
+struct lcnFramer_s
+{
+  unsigned char buf[2*LCN_FRAME_RING]; /*!<\brief bytes not yet assigned to a packet */
+  struct lcnCand_s cand[LCN_FRAME_RING]; /*!<\brief packet starting at each buffer position */
+  int head;                /*!<\brief ring position of the oldest byte */
+  int len;                 /*!<\brief number of bytes in buf */
+  int lazy;                /*!<\brief 1 while only the oldest packet is updated */
+  int lost;                /*!<\brief 1 while looking for the start of a valid packet */
+  unsigned char junkBuf[LCN_FRAME_MAX]; /*!<\brief dropped bytes not yet passed on */
+  int junkLen;             /*!<\brief number of bytes in junkBuf */
+  lcnFrameFunc_t pak;      /*!<\brief called for each valid packet */
+  lcnFrameFunc_t junk;     /*!<\brief called for bytes not belonging to a valid packet */
+  int verbose;             /*!<\brief 1 to print a message when sync is lost */
+  unsigned long frames;    /*!<\brief number of valid packets */
+  unsigned long crcErrors; /*!<\brief number of packets with CRC error */
+  unsigned long resyncs;   /*!<\brief number of times the framer lost sync */
+  unsigned long garbage;   /*!<\brief number of bytes not belonging to a valid packet */
+};
+
+/*! \brief size of the buffer data from the serial port is read into */
+#define LCN_RX_BUF     4096
+
+/*! \brief statistics of the serial port */
+struct lcnSerStat_s
+{
+  unsigned long wakeups;   /*!<\brief calls of lcnSerDataGet that found data */
+  unsigned long reads;     /*!<\brief read() calls returning data */
+  unsigned long bytes;     /*!<\brief number of bytes read */
+  unsigned long txBytes;   /*!<\brief number of bytes written */
+  unsigned long txStalls;  /*!<\brief number of times the driver did not take all bytes */
+  unsigned long txDrops;   /*!<\brief number of packets dropped because _lcnTx was full */
+};
+
+/*! \brief size of the transmit byte ring (power of 2) */
+#define LCN_TX_BUF     512
+
+/*! \brief bytes waiting to be written to the serial port */
+struct lcnTx_s
+{
+  unsigned char buf[LCN_TX_BUF]; /*!<\brief ring of bytes */
+  unsigned int head;       /*!<\brief index of the first byte to write */
+  unsigned int len;        /*!<\brief number of bytes in the ring */
+  int waiting;             /*!<\brief 1 while EV_WRITE is requested */
+};
+
+/*! \brief connection to the LCN bus
+ *
+ *  The send queue and the ack handling work on binary LCN packets,
+ *  a transport hands them to the bus and feeds received packets to
+ *  lcnPakProc.
+ */
+struct lcnTrans_s
+{
+  char *name;              /*!<\brief name used in messages */
+  int (*open)(void);       /*!<\brief connect, returns fd to watch (0: none, -1: error) */
+  int (*put)(int inFd, unsigned char *data, int inLen); /*!<\brief send packet, 0:OK, -1:ERROR */
+  int (*pending)(int inFd); /*!<\brief bytes not yet handed to the bus, -1: not ready */
+  void (*event)(int inFd, int inEvents); /*!<\brief fd is ready (see evFdFunc_t) */
+  int paced;               /*!<\brief 1: packets are paced to the baud rate of the bus */
+};
+
+/*! \brief max. length of a queued LCN packet */
+#define LCN_SLOT_SIZE  20
+
+/*! \brief max. number of packets in the LCN send queue */
+#define LCN_QUEUE_LEN  256
+
+/*! \brief add byte x to LCN CRC s (same result as lcnCrcStep) */
+#define LCN_CRC_STEP(x, s) (_lcnCrcTab[(x) + (s)])
+
+/* bus timing used to pace outgoing packets */
+
+#define LCN_BAUD        9600  /* default baud rate of the LCN-PK */
+#define LCN_VMIN_MAX    8     /* max. VMIN, larger values hold back short packets */
+#define LCN_BYTE_BITS   10    /* bits per byte on the wire (start + 8 + stop) */
+#define LCN_GAP         0.005 /* min. idle time on the bus between two packets (s) */
+#define LCN_ACK_TIMEOUT 0.1   /* time to wait for an ack before sending again (s) */
+
+/* window of packets waiting for an ack */
+
+#define LCN_ACQ_WIN     4  /* max. number of unacknowledged packets (one per module) */
+#define LCN_ACQ_TRIES   5  /* number of times a packet is sent without ack */
+
+/* retransmit timeout, derived from the measured ack round trip time */
+
+#define LCN_RTO_MIN     0.05 /* lower limit of the timeout (s) */
+#define LCN_RTO_MAX     2.0  /* upper limit of the timeout incl. backoff (s) */
+#define LCN_RTO_JITTER  0.25 /* timeout is stretched randomly by up to this factor */
+#define LCN_SUSPECT     2    /* failed packets in a row that make a module suspect */
+
+/* priority lanes of the LCN send queue (lower value = higher priority) */
+
+#define LCN_PRIO_TIMED  0 /* timing critical packets (shutter start/stop) */
+#define LCN_PRIO_USER   1 /* commands requested by clients */
+#define LCN_PRIO_POLL   2 /* background status polls */
+#define LCN_PRIO_NUM    3
+
+/*! \brief max. number of packets sent from higher lanes while polls are waiting */
+#define LCN_POLL_STARVE 8
+
+/*! \brief slot of the LCN send queue */
+struct lcnSlot_s
+{
+  unsigned char len;                  /*!<\brief length of the LCN packet */
+  unsigned char data[LCN_SLOT_SIZE];  /*!<\brief LCN packet data */
+  unsigned long tick;                 /*!<\brief time the packet was queued */
+};
+
+/*! \brief sent packet waiting for an ack from its destination module */
+struct lcnAcq_s
+{
+  int used;                /*!<\brief 1 if entry is in use */
+  struct lcnSlot_s slot;   /*!<\brief copy of the sent packet */
+  int count;               /*!<\brief number of times the packet has been sent */
+  double sent;             /*!<\brief time the packet was last on the bus */
+  double due;              /*!<\brief time the packet is sent again */
+};
+
+/*! \brief ack statistics of a LCN module */
+struct lcnMod_s
+{
+  double srtt;             /*!<\brief smoothed ack round trip time (0 if unknown) */
+  double rttvar;           /*!<\brief mean deviation of the round trip time */
+  int fails;               /*!<\brief number of undelivered packets in a row */
+  int suspect;             /*!<\brief 1 if the module does not answer recently */
+};
+
+/*! \brief preallocated ring of outgoing LCN packets */
+struct lcnRing_s
+{
+  struct lcnSlot_s slot[LCN_QUEUE_LEN]; /*!<\brief packet slots */
+  int head;                /*!<\brief index of first packet */
+  unsigned long seq;       /*!<\brief number of packets ever taken from the ring */
+  int num;                 /*!<\brief number of packets ready for sending */
+  int pending;             /*!<\brief number of packets behind them in an open batch */
+  int drops;               /*!<\brief number of packets refused because the ring was full */
+  unsigned long sent;      /*!<\brief number of packets taken from the ring */
+  unsigned long waitSum;   /*!<\brief sum of ticks the taken packets have been waiting */
+  unsigned long waitMax;   /*!<\brief max. ticks a taken packet has been waiting */
+  unsigned long coalesced; /*!<\brief number of queued packets rewritten by newer ones */
+};
+
+/*! \brief size of the coalescing index per destination (output commands are below) */
+#define LCN_COAL_CMDS  8
+
+/*! \brief check if packet sets output 1, 2 or 3 to an absolute value (only these are coalesced)
+ *
+ *  Relative changes and toggling (p2 0xFB..0xFD) depend on the previous
+ *  value, so they are neither merged nor overtaken.
+ */
+#define LCN_COAL_OK(len, d) ((len) == 8 && ((d)[1] == 0x04 || (d)[1] == 0x05) \
+			     && ((d)[5] == 3 || (d)[5] == 4 || (d)[5] == 5) \
+			     && (d)[6] <= 0xC8 && (d)[7] < 0xFB)
+
+/*! \brief priority lanes of the LCN send queue */
+extern struct lcnRing_s _lcnSendQueue[LCN_PRIO_NUM];
+extern struct lcnFramer_s _lcnRx;
+extern struct lcnSerStat_s _lcnSerStat;
+extern struct lcnTx_s _lcnTx;
+extern struct lcnTrans_s _lcnTransSerial;
+extern struct lcnTrans_s *_lcnTrans;
+extern const unsigned char _lcnBitRev[256];
+extern const unsigned char _lcnCrcTab[511];
+
 extern int open_lcnport(void);
+extern void lcnSerStatPrint(void);
 extern float decodeRamp(int n);
 extern void decodeTime(int n);
 extern void decode(unsigned char *p, int len);
 extern int lcnCrcStep(int x, int store);
 extern unsigned char lcnCrcCalc(unsigned char *list, int len);
+extern int lcnCrcCheck(unsigned char **inPaks, int *inLens, int inNum, unsigned char *outOk);
+extern int lcnFrameLen(int inInfo);
 extern void lcnPakSend(int inFd, struct pak_s *p);
 extern void lcnCommandSend(int inFd, int inDest, int inCmd, int inP1, int inP2);
-extern void lcnQueueCommandSend(int inFd, int inDest, int inCmd, int inP1, int inP2);
+extern int lcnQueueCommandSend(int inFd, int inDest, int inCmd, int inP1, int inP2, int inPrio);
 extern void lcnCommandSendTimed(unsigned long tm, int inFd, int inDest, int inCmd, int inP1, int inP2);
-extern int lcnPakVerify(unsigned char *p, int inLen);
-extern int lcnPakValidScan(unsigned char *p, int inLen);
+extern void lcnFramerInit(struct lcnFramer_s *f, lcnFrameFunc_t inPak, lcnFrameFunc_t inJunk);
+extern void lcnFramerReset(struct lcnFramer_s *f);
+extern void lcnFramerByte(struct lcnFramer_s *f, unsigned char inByte);
+extern void lcnFramerFlush(struct lcnFramer_s *f);
+extern void lcnPakTrace(unsigned char *p, int inLen);
 extern void lcnPakProc(unsigned char *p, int inLen);
 extern void lcnSerDataGet(int inFd);
+extern void lcnTxFlush(int inFd);
+extern int lcnTxPending(int inFd);
+extern int lcnTxPut(int inFd, unsigned char *data, int inLen);
 extern void lcnPrint(unsigned char *p, int len);
+extern void lcnPrint2(unsigned char *p, int len);
+extern int lcnPkMatch(unsigned char *p, int len);
+extern int lcnPkDecode(unsigned char *p, int len);
 extern void lcnSendNext(int inFd);
+extern void lcnSendInit(void);
+extern void lcnSendKick(void);
+extern void lcnBusUse(int inBytes, int inSent);
 
-extern void lcnQueueCmdAdd(struct lcnPak_s *pk, int len);
+extern int lcnQueueCmdAdd(struct lcnPak_s *pk, int len, int inPrio);
+extern void lcnQueueBatchBegin(void);
+extern void lcnQueueBatchEnd(void);
+extern int lcnQueueDepth(void);
+extern int lcnQueueFree(int inPrio);
 
 #endif
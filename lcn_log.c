@@ -0,0 +1,257 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "yali.h"
+
+/*! \brief base name of the log segments, NULL if logging is off */
+char *_lcnLogPrefix = NULL;
+
+/*! \brief file descriptors of the current segment and its index */
+int _lcnLogFd = -1;
+int _lcnLogIdxFd = -1;
+
+/*! \brief number of the current segment */
+int _lcnLogSeg = 0;
+
+/*! \brief size of the current segment including buffered records */
+long _lcnLogSize = 0;
+
+/*! \brief segment size at which the next index entry is written */
+long _lcnLogIdxNext = 0;
+
+/*! \brief monotonic time the current segment was started */
+double _lcnLogStart = 0.0;
+
+/*! \brief records not yet written to the segment */
+unsigned char _lcnLogBuf[LCN_LOG_BUF];
+int _lcnLogLen = 0;
+
+/*! \brief index entries not yet written */
+unsigned char _lcnLogIdx[LCN_LOG_BUF / LCN_LOG_IDX_STEP * 8 + 8];
+int _lcnLogIdxLen = 0;
+
+/*! \brief timer flushing the buffers while the server is idle */
+struct evTimer_s _lcnLogTimer;
+
+
+/*! \brief write a block completely
+ *  \param inFd file descriptor
+ *  \param p data
+ *  \param inLen number of bytes
+ *  \return N/A
+ */
+void lcnLogWrite(int inFd, unsigned char *p, int inLen)
+{
+  int n;
+  int ret;
+
+  n = 0;
+  while (n < inLen)
+    {
+      ret = write(inFd, p+n, inLen-n);
+      if (ret <= 0)
+	{
+	  perror("writing LCN log");
+	  return;
+	}
+      n += ret;
+    }
+}
+
+
+/*! \brief write buffered records and index entries to disk
+ *  \return N/A
+ */
+void lcnLogFlush(void)
+{
+  if (_lcnLogFd < 0) return;
+
+  lcnLogWrite(_lcnLogFd, _lcnLogBuf, _lcnLogLen);
+  _lcnLogLen = 0;
+
+  lcnLogWrite(_lcnLogIdxFd, _lcnLogIdx, _lcnLogIdxLen);
+  _lcnLogIdxLen = 0;
+}
+
+
+/*! \brief timer function flushing the log
+ *  \param inCtx unused
+ *  \return N/A
+ */
+void lcnLogTimerFunc(void *inCtx)
+{
+  lcnLogFlush();
+}
+
+
+/*! \brief close current segment and start the next one
+ *  \return 0:OK, -1:error
+ */
+int lcnLogRotate(void)
+{
+  char cbuf[256];
+  unsigned char hdr[LCN_LOG_HDR];
+  uint32_t tmp;
+
+  if (_lcnLogFd >= 0)
+    {
+      lcnLogFlush();
+      close(_lcnLogFd);
+      close(_lcnLogIdxFd);
+      _lcnLogFd = -1;
+      _lcnLogIdxFd = -1;
+    }
+
+  /* never overwrite segments of earlier runs */
+  do
+    {
+      _lcnLogSeg++;
+      snprintf(cbuf, sizeof(cbuf), "%s_%04i.lcnlog", _lcnLogPrefix, _lcnLogSeg);
+    }
+  while (access(cbuf, F_OK) == 0);
+
+  _lcnLogFd = open(cbuf, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (_lcnLogFd < 0)
+    {
+      perror(cbuf);
+      return -1;
+    }
+
+  snprintf(cbuf, sizeof(cbuf), "%s_%04i.lcnidx", _lcnLogPrefix, _lcnLogSeg);
+  _lcnLogIdxFd = open(cbuf, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (_lcnLogIdxFd < 0)
+    {
+      perror(cbuf);
+      close(_lcnLogFd);
+      _lcnLogFd = -1;
+      return -1;
+    }
+
+  memcpy(hdr, LCN_LOG_MAGIC, 8);
+  tmp = htonl((uint32_t) time(NULL));
+  memcpy(&hdr[8], &tmp, 4);
+  tmp = htonl(_lcnLogSeg);
+  memcpy(&hdr[12], &tmp, 4);
+  memcpy(_lcnLogBuf, hdr, LCN_LOG_HDR);
+
+  _lcnLogLen = LCN_LOG_HDR;
+  _lcnLogIdxLen = 0;
+  _lcnLogSize = LCN_LOG_HDR;
+  _lcnLogIdxNext = LCN_LOG_HDR;
+  _lcnLogStart = evTimeGet();
+
+  return 0;
+}
+
+
+/*! \brief start logging LCN traffic
+ *  \param inPrefix base name of the log segments
+ *  \return 0:OK, -1:error
+ *
+ *  Must be called after evLoopInit, buffered records are flushed by a
+ *  timer of the event loop.
+ */
+int lcnLogOpen(char *inPrefix)
+{
+  _lcnLogPrefix = inPrefix;
+  _lcnLogSeg = 0;
+  memset(&_lcnLogTimer, 0, sizeof(_lcnLogTimer));
+
+  return lcnLogRotate();
+}
+
+
+/*! \brief append LCN packet to the log
+ *  \param inDir LCN_LOG_RX or LCN_LOG_TX
+ *  \param p pointer to LCN packet
+ *  \param inLen length of LCN packet
+ *  \return N/A
+ *
+ *  The record is only copied to a buffer, which is written when it is
+ *  full or LCN_LOG_FLUSH seconds later.
+ */
+void lcnLogPak(int inDir, unsigned char *p, int inLen)
+{
+  unsigned char *rp;
+  uint32_t ms;
+  uint32_t tmp;
+  double now;
+
+  if (_lcnLogFd < 0) return;
+  if (inLen > 255) inLen = 255;
+
+  now = evTimeGet();
+  if (_lcnLogSize >= LCN_LOG_SEG_SIZE || now - _lcnLogStart >= LCN_LOG_SEG_TIME)
+    {
+      if (lcnLogRotate() != 0) return;
+    }
+
+  if (_lcnLogLen + LCN_LOG_REC + inLen > LCN_LOG_BUF) lcnLogFlush();
+
+  ms = (uint32_t) (1000.0 * (now - _lcnLogStart));
+
+  if (_lcnLogSize >= _lcnLogIdxNext)
+    {
+      tmp = htonl(ms);
+      memcpy(&_lcnLogIdx[_lcnLogIdxLen], &tmp, 4);
+      tmp = htonl((uint32_t) _lcnLogSize);
+      memcpy(&_lcnLogIdx[_lcnLogIdxLen+4], &tmp, 4);
+      _lcnLogIdxLen += 8;
+      _lcnLogIdxNext = _lcnLogSize + LCN_LOG_IDX_STEP;
+    }
+
+  rp = &_lcnLogBuf[_lcnLogLen];
+  rp[0] = inLen;
+  rp[1] = inDir;
+  tmp = htonl(ms);
+  memcpy(&rp[2], &tmp, 4);
+  memcpy(&rp[LCN_LOG_REC], p, inLen);
+
+  _lcnLogLen += LCN_LOG_REC + inLen;
+  _lcnLogSize += LCN_LOG_REC + inLen;
+
+  if (!_lcnLogTimer.active)
+    {
+      evTimerStart(&_lcnLogTimer, LCN_LOG_FLUSH, 0.0, lcnLogTimerFunc, NULL);
+    }
+}
+
+
+/*! \brief flush and close the log
+ *  \return N/A
+ */
+void lcnLogClose(void)
+{
+  if (_lcnLogFd < 0) return;
+
+  evTimerStop(&_lcnLogTimer);
+  lcnLogFlush();
+  close(_lcnLogFd);
+  close(_lcnLogIdxFd);
+  _lcnLogFd = -1;
+  _lcnLogIdxFd = -1;
+}
@@ -0,0 +1,63 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LCN_LOG_H
+#define _LCN_LOG_H
+
+/*
+  Binary LCN traffic log
+
+  The log is split into segments <prefix>_NNNN.lcnlog. Each segment starts
+  with a header of LCN_LOG_HDR bytes:
+
+    0..7   magic "YALILOG1"
+    8..11  wall clock time the segment was started (seconds since 1970)
+    12..15 segment number
+
+  followed by records of LCN_LOG_REC + len bytes:
+
+    0      length of the LCN packet
+    1      direction (LCN_LOG_RX, LCN_LOG_TX)
+    2..5   monotonic time since start of segment (ms)
+    6..    LCN packet
+
+  Every LCN_LOG_IDX_STEP bytes of records an entry is appended to the
+  index <prefix>_NNNN.lcnidx: time (ms) and file offset of the record.
+  All numbers are in network byte order.
+*/
+
+#define LCN_LOG_MAGIC     "YALILOG1"
+#define LCN_LOG_HDR       16
+#define LCN_LOG_REC       6
+
+#define LCN_LOG_RX        0 /* packet received from the bus */
+#define LCN_LOG_TX        1 /* packet sent to the bus */
+
+#define LCN_LOG_SEG_SIZE  (1024*1024) /* max. size of a segment (bytes) */
+#define LCN_LOG_SEG_TIME  3600        /* max. age of a segment (s) */
+#define LCN_LOG_IDX_STEP  4096        /* bytes of records per index entry */
+#define LCN_LOG_BUF       16384       /* size of the write buffer */
+#define LCN_LOG_FLUSH     1.0         /* max. time records stay in the buffer (s) */
+
+extern int lcnLogOpen(char *inPrefix);
+extern void lcnLogPak(int inDir, unsigned char *p, int inLen);
+extern void lcnLogFlush(void);
+extern void lcnLogClose(void);
+
+#endif /* _LCN_LOG_H */
@@ -0,0 +1,581 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "yali.h"
+
+void lcnPchkFdEvent(int inFd, int inEvents, void *inCtx);
+void lcnPchkClose(int inFd);
+
+/*! \brief connection to the LCN-PCHK */
+struct lcnPchk_s _lcnPchk;
+
+/*! \brief timer for reconnecting to the LCN-PCHK */
+struct evTimer_s _lcnPchkTimer;
+
+/*! \brief address of the LCN-PCHK, resolved once at startup */
+struct sockaddr_in _lcnPchkAddr;
+
+
+/*! \brief convert a LCN packet to commands of the PCK text protocol
+ *  \param p pointer to LCN packet (with CRC)
+ *  \param inLen length of the packet
+ *  \param outBuf buffer for the commands (one per line)
+ *  \param inSize size of outBuf
+ *  \return length of the commands, -1 if there is no equivalent
+ *
+ *  Only the commands generated by yaliServ itself are known: setting
+ *  an output, the shutter relays and the output status request. The
+ *  PCHK acknowledges a command if the packet asked for an ack, for a
+ *  status request the last of the three commands asks for it.
+ */
+int lcnPchkCmd(unsigned char *p, int inLen, char *outBuf, int inSize)
+{
+  char addr[16];
+  char relay[9];
+  int ack;
+  int out;
+  int n;
+  int i;
+
+  if (inLen != 8 || (p[1] != 4 && p[1] != 5)) return -1;
+
+  ack = (p[1] == 5);
+  snprintf(addr, sizeof(addr), ">M%03i%03i", p[3], p[4]);
+
+  switch (p[5])
+    {
+    case 4:
+    case 5:
+    case 3:
+      /* set output to p1*2 % with ramp p2 */
+      if (p[6] > 50 || p[7] > 250) return -1;
+
+      out = (p[5] == 3) ? 3 : p[5] - 3;
+      n = snprintf(outBuf, inSize, "%s%cA%iDI%03i%03i\n",
+		   addr, ack ? '!' : '.', out, p[6] * 2, p[7]);
+      break;
+
+    case 0x13:
+      /* relays: bit i of p1 selects relay i, bit i of p2 is 0 for on and 1 for off */
+      for (i=0; i<8; i++)
+	{
+	  switch ((((p[6] >> i) & 1) << 1) | ((p[7] >> i) & 1))
+	    {
+	    case 0: relay[i] = '-'; break;
+	    case 1: relay[i] = 'U'; break;
+	    case 2: relay[i] = '1'; break;
+	    case 3: relay[i] = '0'; break;
+	    }
+	}
+      relay[8] = 0;
+
+      n = snprintf(outBuf, inSize, "%s%cR8%s\n", addr, ack ? '!' : '.', relay);
+      break;
+
+    case 0x6E:
+      /* status request of the outputs, answered by one status per output */
+      if (p[6] != 0xFB || p[7] != 0x01) return -1;
+
+      n = snprintf(outBuf, inSize, "%s.SMA1\n%s.SMA2\n%s%cSMA3\n",
+		   addr, addr, addr, ack ? '!' : '.');
+      break;
+
+    default:
+      return -1;
+    }
+
+  if (n >= inSize) return -1;
+
+  return n;
+}
+
+
+/*! \brief convert a line received from the LCN-PCHK to a LCN packet
+ *  \param inLine line without line end
+ *  \param outPak buffer for the packet (at least 8 bytes)
+ *  \return length of the packet, 0 if the line has no equivalent
+ *
+ *  An ack becomes an ack packet for the module, an output status
+ *  becomes the command setting the output, so lcnPakProc handles both
+ *  like packets received from the LCN-PK.
+ */
+int lcnPchkLine(char *inLine, unsigned char *outPak)
+{
+  int seg;
+  int mod;
+  int out;
+  int val;
+  char c;
+  int len;
+
+  memset(outPak, 0, 8);
+
+  if (sscanf(inLine, "-M%3d%3d%c", &seg, &mod, &c) == 3 && c == '!'
+      && seg >= 0 && seg <= 255 && mod >= 0 && mod <= 255)
+    {
+      /* positive ack: from module to us (see lcnPakProc) */
+      outPak[0] = _lcnBitRev[mod];
+      outPak[1] = 0;
+      outPak[3] = seg;
+      outPak[4] = _lcnBitRev[0x80];
+      len = 6;
+    }
+  else if (sscanf(inLine, ":M%3d%3dA%1d%3d", &seg, &mod, &out, &val) == 4
+	   && seg >= 0 && seg <= 255 && mod >= 0 && mod <= 255
+	   && out >= 1 && out <= 3 && val >= 0 && val <= 100)
+    {
+      /* output status in percent */
+      outPak[0] = _lcnBitRev[mod];
+      outPak[1] = 4;
+      outPak[3] = seg;
+      outPak[4] = mod;
+      outPak[5] = (out == 3) ? 3 : out + 3;
+      outPak[6] = val / 2;
+      outPak[7] = 0;
+      len = 8;
+    }
+  else
+    {
+      return 0;
+    }
+
+  outPak[2] = lcnCrcCalc(outPak, len);
+
+  return len;
+}
+
+
+/*! \brief send a line to the LCN-PCHK
+ *  \param inFd socket
+ *  \param inText line(s) including line end
+ *  \return 0:OK, -1:transmit buffer full
+ */
+int lcnPchkWrite(int inFd, char *inText)
+{
+  if (_conf.showLcnTraffic) printf("PCHK>>> %s", inText);
+
+  return lcnTxPut(inFd, (unsigned char*) inText, strlen(inText));
+}
+
+
+/*! \brief resolve the LCN-PCHK given by _conf.lcnInterface (host[:port])
+ *  \return 0:OK, -1:unknown host
+ *
+ *  Done once at startup, gethostbyname may block for a long time.
+ */
+int lcnPchkResolve(void)
+{
+  char host[256];
+  char *cp;
+  int port;
+  struct hostent *ad;
+
+  snprintf(host, sizeof(host), "%s", _conf.lcnInterface);
+  port = LCN_PCHK_PORT;
+  cp = strchr(host, ':');
+  if (cp != NULL)
+    {
+      *cp = 0;
+      port = atoi(cp + 1);
+    }
+
+  ad = gethostbyname(host);
+  if (ad == NULL)
+    {
+      fprintf(stderr, "lcnPchkResolve: unknown host %s\n", host);
+      return -1;
+    }
+
+  memset(&_lcnPchkAddr, 0, sizeof(_lcnPchkAddr));
+  _lcnPchkAddr.sin_family = AF_INET;
+  _lcnPchkAddr.sin_port = htons(port);
+  memcpy(&_lcnPchkAddr.sin_addr, ad->h_addr, sizeof(_lcnPchkAddr.sin_addr));
+
+  return 0;
+}
+
+
+/*! \brief start connecting to the LCN-PCHK
+ *  \return socket, -1 on error
+ *
+ *  The socket is non-blocking, lcnPchkConnected is called from the
+ *  event loop once the connection has been established or has failed.
+ */
+int lcnPchkConnect(void)
+{
+  int fd;
+  int one;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    {
+      perror("lcnPchkConnect: socket failed");
+      return -1;
+    }
+
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+
+  /* commands are short lines, don't let them wait for more data */
+  one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (connect(fd, (struct sockaddr *) &_lcnPchkAddr, sizeof(_lcnPchkAddr)) == -1
+      && errno != EINPROGRESS)
+    {
+      perror("lcnPchkConnect: Unable to connect to LCN-PCHK");
+      close(fd);
+      return -1;
+    }
+
+  if (evFdAdd(fd, EV_WRITE, lcnPchkFdEvent, NULL) != 0)
+    {
+      close(fd);
+      return -1;
+    }
+
+  _lcnPchk.state = LCN_PCHK_CONNECT;
+  _lcnPchk.len = 0;
+  _lcnSerFd = fd;
+
+  return fd;
+}
+
+
+/*! \brief check the result of a connect started by lcnPchkConnect
+ *  \param inFd socket
+ *  \return N/A
+ *
+ *  The login is done later by lcnPchkProc, packets wait in the send
+ *  queue until the PCHK accepts commands.
+ */
+void lcnPchkConnected(int inFd)
+{
+  int err;
+  socklen_t len;
+
+  len = sizeof(err);
+  if (getsockopt(inFd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) err = errno;
+
+  if (err != 0)
+    {
+      fprintf(stderr, "lcnPchkConnected: Unable to connect to LCN-PCHK: %s\n", strerror(err));
+      lcnPchkClose(inFd);
+      return;
+    }
+
+  printf("connected to LCN-PCHK %s\n", _conf.lcnInterface);
+  _lcnPchk.state = LCN_PCHK_LOGIN;
+  evFdMod(inFd, EV_READ);
+}
+
+
+/*! \brief connect to the LCN-PCHK at startup
+ *  \return 0 (the socket is watched by lcnPchkFdEvent), -1 on error
+ *
+ *  If the PCHK cannot be reached, the reconnect timer tries again later.
+ */
+int lcnPchkOpen(void)
+{
+  if (_conf.lcnInterface==NULL || *_conf.lcnInterface==0)
+    {
+      printf("running in test mode without LCN\n");
+      _conf.lcnInterface = NULL;
+      return 0;
+    }
+
+  memset(&_lcnPchk, 0, sizeof(_lcnPchk));
+  _lcnPchk.retry = LCN_PCHK_RETRY;
+
+  if (lcnPchkResolve() != 0) return -1;
+
+  if (lcnPchkConnect() < 0) lcnPchkRetry();
+
+  return 0;
+}
+
+
+/*! \brief event loop callback of the PCHK socket
+ *  \param inFd socket
+ *  \param inEvents EV_READ, EV_WRITE, EV_ERROR
+ *  \param inCtx unused
+ *  \return N/A
+ */
+void lcnPchkFdEvent(int inFd, int inEvents, void *inCtx)
+{
+  lcnPchkEvent(inFd, inEvents);
+}
+
+
+/*! \brief try to connect again (reconnect timer)
+ *  \param inCtx unused
+ *  \return N/A
+ */
+void lcnPchkReconnect(void *inCtx)
+{
+  if (lcnPchkConnect() < 0) lcnPchkRetry();
+}
+
+
+/*! \brief start the reconnect timer, the delay grows with each failure
+ *  \return N/A
+ */
+void lcnPchkRetry(void)
+{
+  _lcnPchk.state = LCN_PCHK_DOWN;
+  _lcnPchk.reconnects++;
+
+  printf("reconnecting to LCN-PCHK %s in %.0f s\n", _conf.lcnInterface, _lcnPchk.retry);
+  evTimerStart(&_lcnPchkTimer, _lcnPchk.retry, 0.0, lcnPchkReconnect, NULL);
+
+  _lcnPchk.retry *= 2;
+  if (_lcnPchk.retry > LCN_PCHK_RETRY_MAX) _lcnPchk.retry = LCN_PCHK_RETRY_MAX;
+}
+
+
+/*! \brief close the connection to the LCN-PCHK and reconnect later
+ *  \param inFd socket
+ *  \return N/A
+ *
+ *  Bytes not yet written are dropped, packets waiting for an ack are
+ *  repeated after the login.
+ */
+void lcnPchkClose(int inFd)
+{
+  evFdDel(inFd);
+  close(inFd);
+
+  _lcnTx.head = 0;
+  _lcnTx.len = 0;
+  _lcnTx.waiting = 0;
+
+  lcnPchkRetry();
+}
+
+
+/*! \brief send a LCN packet to the LCN-PCHK
+ *  \param inFd socket
+ *  \param data pointer to LCN packet
+ *  \param inLen length of the packet
+ *  \return 0:OK, -1:not logged in, no PCK equivalent or transmit buffer full
+ */
+int lcnPchkPut(int inFd, unsigned char *data, int inLen)
+{
+  char cbuf[LCN_PCHK_LINE];
+
+  if (_lcnPchk.state != LCN_PCHK_READY) return -1;
+
+  if (lcnPchkCmd(data, inLen, cbuf, sizeof(cbuf)) < 0)
+    {
+      _lcnPchk.unknown++;
+      if (_conf.showLcnTraffic) printf("PCHK: packet has no PCK equivalent, dropped\n");
+      return -1;
+    }
+
+  _lcnPchk.sent++;
+
+  return lcnPchkWrite(inFd, cbuf);
+}
+
+
+/*! \brief number of bytes not yet sent to the LCN-PCHK
+ *  \param inFd socket
+ *  \return bytes in the transmit ring, -1 until logged in
+ *
+ *  Bytes in the socket are not counted: TIOCOUTQ includes data not yet
+ *  acknowledged by the peer, which would allow only one packet per round
+ *  trip.
+ */
+int lcnPchkPending(int inFd)
+{
+  if (_lcnPchk.state != LCN_PCHK_READY) return -1;
+
+  return _lcnTx.len;
+}
+
+
+/*! \brief process a line received from the LCN-PCHK
+ *  \param inFd socket
+ *  \param inLine line without line end
+ *  \return N/A
+ */
+void lcnPchkProc(int inFd, char *inLine)
+{
+  unsigned char pak[8];
+  char cbuf[LCN_PCHK_LINE];
+  int len;
+
+  if (_conf.showLcnTraffic) printf("PCHK<<< %s\n", inLine);
+
+  if (_lcnPchk.state == LCN_PCHK_LOGIN)
+    {
+      if (strncmp(inLine, "Username:", 9) == 0)
+	{
+	  snprintf(cbuf, sizeof(cbuf), "%s\n", _conf.lcnPchkUser);
+	  lcnPchkWrite(inFd, cbuf);
+	}
+      else if (strncmp(inLine, "Password:", 9) == 0)
+	{
+	  snprintf(cbuf, sizeof(cbuf), "%s\n", _conf.lcnPchkPass);
+	  lcnPchkWrite(inFd, cbuf);
+	}
+      else if (strcmp(inLine, "OK") == 0)
+	{
+	  /* 50 steps (like the binary commands), status in percent */
+	  lcnPchkWrite(inFd, "!OM0P\n");
+	  _lcnPchk.state = LCN_PCHK_READY;
+	  _lcnPchk.retry = LCN_PCHK_RETRY;
+	  printf("logged in to LCN-PCHK %s\n", _conf.lcnInterface);
+	  lcnSendKick();
+	}
+      else if (strncmp(inLine, "Authentification failed", 23) == 0
+	       || strncmp(inLine, "Authentication failed", 21) == 0)
+	{
+	  fprintf(stderr, "login to LCN-PCHK %s failed\n", _conf.lcnInterface);
+	  lcnPchkClose(inFd);
+	}
+      return;
+    }
+
+  if (strncmp(inLine, "-M", 2) == 0)
+    {
+      if (inLine[strlen(inLine)-1] == '!') _lcnPchk.acks++;
+      else _lcnPchk.naks++;
+    }
+
+  len = lcnPchkLine(inLine, pak);
+  if (len > 0)
+    {
+      lcnPakProc(pak, len);
+    }
+}
+
+
+/*! \brief read all available data from the LCN-PCHK
+ *  \param inFd socket
+ *  \return N/A
+ *
+ *  Lines are split at '\n', a trailing '\r' is removed. Lines longer
+ *  than LCN_PCHK_LINE are truncated.
+ */
+void lcnPchkDataGet(int inFd)
+{
+  static char rcbuf[LCN_RX_BUF];
+  int got;
+  int ret;
+  int i;
+
+  got = 0;
+  while (1)
+    {
+      ret = read(inFd, rcbuf, sizeof(rcbuf));
+      if (ret < 0)
+	{
+	  if (errno == EINTR) continue;
+	  if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+	}
+
+      if (ret <= 0)
+	{
+	  fprintf(stderr, "connection to LCN-PCHK %s lost\n", _conf.lcnInterface);
+	  lcnPchkClose(inFd);
+	  return;
+	}
+
+      if (!got) _lcnSerStat.wakeups++;
+      got = 1;
+      _lcnSerStat.reads++;
+      _lcnSerStat.bytes += ret;
+
+      for (i=0; i<ret; i++)
+	{
+	  if (rcbuf[i] == '\n')
+	    {
+	      if (_lcnPchk.len > 0 && _lcnPchk.line[_lcnPchk.len-1] == '\r') _lcnPchk.len--;
+	      _lcnPchk.line[_lcnPchk.len] = 0;
+	      lcnPchkProc(inFd, _lcnPchk.line);
+	      _lcnPchk.len = 0;
+	      if (_lcnPchk.state == LCN_PCHK_DOWN) return;
+	    }
+	  else if (_lcnPchk.len < LCN_PCHK_LINE - 1)
+	    {
+	      _lcnPchk.line[_lcnPchk.len++] = rcbuf[i];
+	    }
+	}
+    }
+}
+
+
+/*! \brief event handler of the LCN-PCHK transport
+ *  \param inFd socket
+ *  \param inEvents EV_READ, EV_WRITE, EV_ERROR
+ *  \return N/A
+ */
+void lcnPchkEvent(int inFd, int inEvents)
+{
+  if (_lcnPchk.state == LCN_PCHK_CONNECT)
+    {
+      lcnPchkConnected(inFd);
+      return;
+    }
+
+  if (inEvents & EV_WRITE)
+    {
+      lcnTxFlush(inFd);
+      if (_lcnTx.len == 0) lcnSendKick();
+    }
+  if (inEvents & (EV_READ | EV_ERROR)) lcnPchkDataGet(inFd);
+}
+
+
+/*! \brief print statistics of the LCN-PCHK connection
+ *  \return N/A
+ */
+void lcnPchkStatPrint(void)
+{
+  printf("LCN-PCHK: %lu commands, %lu without PCK equivalent, %lu acks, %lu naks, %lu bytes read, %lu reconnects\n",
+	 _lcnPchk.sent, _lcnPchk.unknown, _lcnPchk.acks, _lcnPchk.naks, _lcnSerStat.bytes,
+	 _lcnPchk.reconnects);
+}
+
+
+/*! \brief LCN-PCHK reached by TCP, talking the PCK text protocol
+ *
+ *  The PCHK paces the bus itself, packets are only separated by LCN_GAP.
+ */
+struct lcnTrans_s _lcnTransPchk =
+  {
+    "LCN-PCHK",
+    lcnPchkOpen,
+    lcnPchkPut,
+    lcnPchkPending,
+    lcnPchkEvent,
+    0
+  };
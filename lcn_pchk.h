@@ -0,0 +1,64 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LCN_PCHK_H
+#define _LCN_PCHK_H
+
+/*! \brief default TCP port of the LCN-PCHK */
+#define LCN_PCHK_PORT  4114
+
+/*! \brief max. length of a line of the PCK protocol */
+#define LCN_PCHK_LINE  256
+
+/* delay before reconnecting, doubled after each failure (s) */
+
+#define LCN_PCHK_RETRY      1.0
+#define LCN_PCHK_RETRY_MAX  60.0
+
+/* login states */
+
+#define LCN_PCHK_LOGIN  0 /* waiting for user name and password prompts */
+#define LCN_PCHK_READY  1 /* logged in, commands are accepted */
+#define LCN_PCHK_DOWN   2 /* not connected, waiting for the reconnect timer */
+#define LCN_PCHK_CONNECT 3 /* connect in progress */
+
+/*! \brief connection to a LCN-PCHK */
+struct lcnPchk_s
+{
+  int state;               /*!<\brief LCN_PCHK_xxx */
+  char line[LCN_PCHK_LINE]; /*!<\brief partially received line */
+  int len;                 /*!<\brief number of chars in line */
+  unsigned long sent;      /*!<\brief number of packets converted to PCK commands */
+  unsigned long unknown;   /*!<\brief number of packets that have no PCK equivalent */
+  unsigned long acks;      /*!<\brief number of acks received */
+  unsigned long naks;      /*!<\brief number of negative acks received */
+  unsigned long reconnects; /*!<\brief number of connections lost or refused */
+  double retry;            /*!<\brief delay before the next reconnect (s) */
+};
+
+extern struct lcnPchk_s _lcnPchk;
+extern struct lcnTrans_s _lcnTransPchk;
+
+extern int lcnPchkCmd(unsigned char *p, int inLen, char *outBuf, int inSize);
+extern int lcnPchkLine(char *inLine, unsigned char *outPak);
+extern void lcnPchkRetry(void);
+extern void lcnPchkEvent(int inFd, int inEvents);
+extern void lcnPchkStatPrint(void);
+
+#endif /* _LCN_PCHK_H */
@@ -20,6 +20,7 @@ with this program; if not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 
 #include "yali.h"
 
@@ -90,23 +91,66 @@ struct pkDecode_s _pkDecList[] =
     { NULL, 0, {} }
   };
 
-int lcnPkDecode(unsigned char *p, int len)
+/*! \brief max. number of _pkDecList entries with the same command byte */
+#define PK_DEC_PER_CMD 8
+
+/*! \brief _pkDecList entries by command byte (in list order, -1 terminated) */
+signed char _pkDecByCmd[256][PK_DEC_PER_CMD+1];
+
+/*! \brief 1 if _pkDecByCmd has been built */
+int _pkDecByCmdOk = 0;
+
+/*! \brief sort _pkDecList entries by their command byte
+ *  \return N/A
+ *
+ *  The command byte (byte 5) of all patterns is fixed, so only the
+ *  entries for the command of a packet have to be checked.
+ */
+void lcnPkIndex(void)
+{
+  int idx;
+  int cmd;
+  int n;
+
+  memset(_pkDecByCmd, -1, sizeof(_pkDecByCmd));
+
+  for (idx=0; _pkDecList[idx].func != NULL; idx++)
+    {
+      assert((_pkDecList[idx].pat[0] >> 8) == 0);
+      cmd = _pkDecList[idx].pat[0];
+
+      for (n=0; _pkDecByCmd[cmd][n] != -1; n++);
+      assert(n < PK_DEC_PER_CMD);
+      _pkDecByCmd[cmd][n] = idx;
+    }
+
+  _pkDecByCmdOk = 1;
+}
+
+/*! \brief find entry of _pkDecList matching a LCN packet
+ *  \param p pointer to LCN packet
+ *  \param len length of LCN packet
+ *  \return index into _pkDecList, -1 if no entry matches
+ */
+int lcnPkMatch(unsigned char *p, int len)
 {
   int idx;
+  int n;
   int i;
   int mask;
   int val;
   int tmp;
 
-  if (len==0) return 1; /* no match */
+  if (len<6) return -1; /* no match */
 
-  i = -1;
-  for (idx=0; _pkDecList[idx].func != NULL; idx++)
+  if (!_pkDecByCmdOk) lcnPkIndex();
+
+  for (n=0; (idx = _pkDecByCmd[p[5]][n]) != -1; n++)
     {
       /*printf("%i %i\n", _pkDecList[idx].len, len);*/
       if (_pkDecList[idx].len == len)
 	{
-	  for (i=5; i<len; i++)
+	  for (i=6; i<len; i++)
 	    {
 	      mask = (0xFF ^ (_pkDecList[idx].pat[i-5] >> 8)) & 0xFF;
 	      val = _pkDecList[idx].pat[i-5] & 0xFF;
@@ -114,12 +158,19 @@ int lcnPkDecode(unsigned char *p, int len)
 	      /*printf("  %i %i\n", tmp, val);*/
 	      if ( tmp != val ) break; /* mismatch */
 	    }
-	  if (i==len) break; /* match */
-	  i = -1;
+	  if (i==len) return idx; /* match */
 	}
     }
 
-  if (i != -1)
+  return -1;
+}
+
+int lcnPkDecode(unsigned char *p, int len)
+{
+  int idx;
+
+  idx = lcnPkMatch(p, len);
+  if (idx != -1)
     {
       /*printf("idx=%i\n",idx);*/
       return _pkDecList[idx].func(p);
@@ -407,15 +458,7 @@ void lcnPrint2(unsigned char *p, int len)
 
   crc = lcnCrcCalc(p, len);
 
-  source = 0;
-  for (i=1; i<256; i*=2)
-    {
-      source *= 2;
-      if ( (i & p[0])!=0 )
-	{
-	  source += 1;
-	}
-    }
+  source = _lcnBitRev[p[0]];
 
   info = p[1];
   destSeg = p[3];
@@ -469,15 +512,7 @@ void lcnPrint(unsigned char *p, int len)
 
   crc = lcnCrcCalc(p, len);
 
-  source = 0;
-  for (i=1; i<256; i*=2)
-    {
-      source *= 2;
-      if ( (i & p[0])!=0 )
-	{
-	  source += 1;
-	}
-    }
+  source = _lcnBitRev[p[0]];
 
   info = p[1];
   destSeg = p[3];
@@ -0,0 +1,308 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "yali.h"
+
+
+/*! \brief open the next file of a recording
+ *  \param r pointer to replay
+ *  \return 0:OK, -1:no more files
+ */
+int lcnReplayOpen(struct lcnReplay_s *r)
+{
+  char cbuf[256];
+  unsigned char hdr[LCN_LOG_HDR];
+  struct stat st;
+  uint32_t tmp;
+
+  if (r->fp != NULL)
+    {
+      fclose(r->fp);
+      r->fp = NULL;
+    }
+
+  if (r->kind == LCN_REPLAY_RAW)
+    {
+      /* a single file, opened only once */
+      if (r->seg++ > 0) return -1;
+      snprintf(cbuf, sizeof(cbuf), "%s", r->name);
+    }
+  else
+    {
+      r->seg++;
+      snprintf(cbuf, sizeof(cbuf), "%s_%04i.%s", r->name, r->seg,
+	       (r->kind == LCN_REPLAY_LOG) ? "lcnlog" : "lcn");
+    }
+
+  r->fp = fopen(cbuf, "rb");
+  if (r->fp == NULL) return -1;
+
+  if (r->kind == LCN_REPLAY_LOG)
+    {
+      if (fread(hdr, 1, LCN_LOG_HDR, r->fp) != LCN_LOG_HDR
+	  || memcmp(hdr, LCN_LOG_MAGIC, 8) != 0)
+	{
+	  fprintf(stderr, "%s: not a LCN log\n", cbuf);
+	  return -1;
+	}
+      memcpy(&tmp, &hdr[8], 4);
+      r->segStart = ntohl(tmp);
+    }
+  else
+    {
+      /* no time stamps in the file, use its modification time */
+      fstat(fileno(r->fp), &st);
+      r->segStart = st.st_mtime;
+    }
+
+  return 0;
+}
+
+
+/*! \brief set the replay time of the packet just read
+ *  \param r pointer to replay
+ *  \param inTime its recording time
+ *  \return N/A
+ *
+ *  Segments may come from different runs, so the time between two
+ *  packets may be hours or even negative. Such gaps are cut to
+ *  LCN_REPLAY_GAP_MAX, otherwise the replay would stall.
+ */
+void lcnReplayTime(struct lcnReplay_s *r, double inTime)
+{
+  double gap;
+
+  if (r->recLast > 0.0)
+    {
+      gap = inTime - r->recLast;
+      if (gap < 0.0) r->recCut += gap;
+      else if (gap > LCN_REPLAY_GAP_MAX) r->recCut += gap - LCN_REPLAY_GAP_MAX;
+    }
+  r->recLast = inTime;
+  r->time = inTime - r->recCut;
+}
+
+
+/*! \brief read the next received packet of a recording
+ *  \param r pointer to replay
+ *  \return N/A
+ *
+ *  r->len is 0 at the end of the recording.
+ */
+void lcnReplayRead(struct lcnReplay_s *r)
+{
+  unsigned char rec[LCN_LOG_REC];
+  uint32_t tmp;
+
+  r->len = 0;
+
+  while (r->fp != NULL)
+    {
+      if (r->kind == LCN_REPLAY_LOG)
+	{
+	  if (fread(rec, 1, LCN_LOG_REC, r->fp) == LCN_LOG_REC
+	      && fread(r->pak, 1, rec[0], r->fp) == rec[0])
+	    {
+	      /* packets sent by the server are not replayed */
+	      if (rec[1] != LCN_LOG_RX || rec[0] == 0) continue;
+
+	      memcpy(&tmp, &rec[2], 4);
+	      r->len  = rec[0];
+	      lcnReplayTime(r, r->segStart + 0.001 * ntohl(tmp));
+	      return;
+	    }
+	}
+      else
+	{
+	  r->len = fread(r->pak, 1, sizeof(r->pak), r->fp);
+	  if (r->len > 0)
+	    {
+	      lcnReplayTime(r, r->segStart);
+	      return;
+	    }
+	}
+
+      if (lcnReplayOpen(r) != 0) break;
+    }
+
+  if (r->fp != NULL)
+    {
+      fclose(r->fp);
+      r->fp = NULL;
+    }
+}
+
+
+/*! \brief print statistics of a replay
+ *  \param r pointer to replay
+ *  \return N/A
+ *
+ *  Rates are calculated since the last report: packets decoded by the
+ *  framer, state changes and the mean delay between broadcast of a
+ *  status report and handing it to the kernel.
+ */
+void lcnReplayReport(struct lcnReplay_s *r)
+{
+  double now;
+  double dt;
+  unsigned long fan;
+
+  now = evTimeGet();
+  dt = now - r->lastTime;
+  if (dt <= 0.0) dt = 1e-6;
+
+  fan = _netFanNum - r->lastFan;
+
+  printf("replay: %lu packets, %.0f telegrams/s, %.0f state updates/s, "
+	 "fan-out %lu pkts mean %.3f ms max %.3f ms, %lu CRC errors\n",
+	 r->paks,
+	 (_lcnRx.frames - r->lastFrames) / dt,
+	 (_stateSeq - r->lastSeq) / dt,
+	 fan, fan ? 1000.0 * (_netFanSum - r->lastFanSum) / fan : 0.0,
+	 1000.0 * _netFanMax, _lcnRx.crcErrors);
+
+  r->lastTime = now;
+  r->lastFrames = _lcnRx.frames;
+  r->lastSeq = _stateSeq;
+  r->lastFan = _netFanNum;
+  r->lastFanSum = _netFanSum;
+  _netFanMax = 0.0;
+}
+
+
+/*! \brief timer function printing statistics once per second
+ *  \param inCtx pointer to replay
+ *  \return N/A
+ */
+void lcnReplayReportFunc(void *inCtx)
+{
+  lcnReplayReport((struct lcnReplay_s*) inCtx);
+}
+
+
+/*! \brief timer function injecting the packets that are due
+ *  \param inCtx pointer to replay
+ *  \return N/A
+ *
+ *  At most LCN_REPLAY_BURST packets are injected per call, so clients
+ *  are served in between even at maximum speed.
+ */
+void lcnReplayFunc(void *inCtx)
+{
+  struct lcnReplay_s *r;
+  double due;
+  int i,n;
+
+  r = (struct lcnReplay_s*) inCtx;
+
+  for (n=0; n<LCN_REPLAY_BURST && r->len > 0; n++)
+    {
+      if (r->speed > 0.0)
+	{
+	  due = r->start + (r->time - r->recStart) / r->speed;
+	  if (due > evTimeGet())
+	    {
+	      evTimerStart(&r->timer, due - evTimeGet(), 0.0, lcnReplayFunc, r);
+	      return;
+	    }
+	}
+
+      for (i=0; i<r->len; i++)
+	{
+	  lcnFramerByte(&_lcnRx, r->pak[i]);
+	}
+      /* packets of a per-packet recording are complete */
+      if (r->kind == LCN_REPLAY_PAK) lcnFramerFlush(&_lcnRx);
+      r->paks++;
+
+      lcnReplayRead(r);
+    }
+
+  if (r->len > 0)
+    {
+      evTimerStart(&r->timer, 0.0, 0.0, lcnReplayFunc, r);
+      return;
+    }
+
+  lcnFramerFlush(&_lcnRx);
+  evTimerStop(&r->report);
+
+  lcnReplayReport(r);
+  printf("replay of \"%s\" finished after %.1f s\n", r->name, evTimeGet() - r->start);
+}
+
+
+/*! \brief start replaying recorded LCN traffic
+ *  \param r pointer to replay structure (must stay valid while replaying)
+ *  \param inName file name or prefix of the recording
+ *  \param inSpeed 1.0 = real time, 2.0 = twice as fast, 0 = as fast as possible
+ *  \return 0:OK, -1:recording not found
+ *
+ *  inName may be the prefix of a log written with -b (segments
+ *  <prefix>_NNNN.lcnlog or, from older versions, one file per packet
+ *  <prefix>_NNNN.lcn) or a single file of raw serial data. The received
+ *  packets are fed into the framer like data from the serial interface.
+ *  Needs the event loop.
+ */
+int lcnReplayStart(struct lcnReplay_s *r, char *inName, double inSpeed)
+{
+  char cbuf[256];
+
+  memset(r, 0, sizeof(struct lcnReplay_s));
+  r->name = inName;
+  r->speed = inSpeed;
+
+  snprintf(cbuf, sizeof(cbuf), "%s_0001.lcnlog", inName);
+  if (access(cbuf, R_OK) == 0)
+    {
+      r->kind = LCN_REPLAY_LOG;
+    }
+  else
+    {
+      snprintf(cbuf, sizeof(cbuf), "%s_0001.lcn", inName);
+      r->kind = (access(cbuf, R_OK) == 0) ? LCN_REPLAY_PAK : LCN_REPLAY_RAW;
+    }
+
+  if (lcnReplayOpen(r) != 0)
+    {
+      if (r->fp != NULL) fclose(r->fp);
+      return -1;
+    }
+
+  lcnReplayRead(r);
+  r->recStart = r->time;
+  r->start = evTimeGet();
+  r->lastTime = r->start;
+  r->lastFrames = _lcnRx.frames;
+  r->lastSeq = _stateSeq;
+  r->lastFan = _netFanNum;
+  r->lastFanSum = _netFanSum;
+
+  evTimerStart(&r->timer, 0.0, 0.0, lcnReplayFunc, r);
+  evTimerStart(&r->report, 1.0, 1.0, lcnReplayReportFunc, r);
+
+  return 0;
+}
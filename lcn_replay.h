@@ -0,0 +1,69 @@
+/*
+  YALI - Yet Another LCN Interface
+
+Copyright (C) 2009 Daniel Dallmann
+
+This program is free software; you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the 
+Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY 
+or FITNESS FOR A PARTICULAR PURPOSE. 
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LCN_REPLAY_H
+#define _LCN_REPLAY_H
+
+/* kinds of recorded traffic */
+
+#define LCN_REPLAY_LOG   1 /* segments <prefix>_NNNN.lcnlog (see lcn_log.h) */
+#define LCN_REPLAY_PAK   2 /* one file per packet <prefix>_NNNN.lcn */
+#define LCN_REPLAY_RAW   3 /* single file holding raw serial data */
+
+/*! \brief max. number of packets injected per call of the replay timer */
+#define LCN_REPLAY_BURST 256
+
+/*! \brief max. pause between two packets in seconds of recording time,
+ *  longer gaps (e.g. between segments of different runs) are cut */
+#define LCN_REPLAY_GAP_MAX 10.0
+
+/*! \brief state of a running replay */
+struct lcnReplay_s
+{
+  char *name;              /*!<\brief file name or prefix of the recording */
+  int kind;                /*!<\brief LCN_REPLAY_xxx */
+  double speed;            /*!<\brief 1.0 = real time, 0 = as fast as possible */
+  FILE *fp;                /*!<\brief currently read file */
+  int seg;                 /*!<\brief number of currently read file */
+  double segStart;         /*!<\brief recording time the segment was started */
+
+  unsigned char pak[256];  /*!<\brief next packet (or block of raw data) */
+  int len;                 /*!<\brief its length, 0 at end of recording */
+  double time;             /*!<\brief its recording time */
+  double recLast;          /*!<\brief uncut recording time of the last packet */
+  double recCut;           /*!<\brief sum of the cut gaps */
+
+  double recStart;         /*!<\brief recording time of the first packet */
+  double start;            /*!<\brief time (see evTimeGet) the replay started */
+  unsigned long paks;      /*!<\brief number of injected packets */
+
+  double lastTime;         /*!<\brief time of the last report */
+  unsigned long lastFrames; /*!<\brief _lcnRx.frames at the last report */
+  unsigned long lastSeq;   /*!<\brief _stateSeq at the last report */
+  unsigned long lastFan;   /*!<\brief _netFanNum at the last report */
+  double lastFanSum;       /*!<\brief _netFanSum at the last report */
+
+  struct evTimer_s timer;  /*!<\brief timer injecting the packets */
+  struct evTimer_s report; /*!<\brief timer printing the statistics */
+};
+
+extern int lcnReplayStart(struct lcnReplay_s *r, char *inName, double inSpeed);
+extern void lcnReplayReport(struct lcnReplay_s *r);
+
+#endif /* _LCN_REPLAY_H */
@@ -20,15 +20,32 @@ with this program; if not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <sys/errno.h>
 #include <assert.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 
 #include "yali.h"
 
-/*!\brief array used to store TCP/IP client data */
-struct netClientDat_s _cli[CLI_NUM];
+/*!\brief list of active TCP/IP client connections */
+struct netClientDat_s *_netCliList = NULL;
+
+/*!\brief list of unused client structures */
+struct netClientDat_s *_netCliFree = NULL;
+
+/*!\brief number of active client connections */
+int _netCliNum = 0;
+
+/*!\brief number used for the next accepted client */
+int _netCliId = 0;
+
+/*!\brief timer used to terminate clients marked for closing */
+struct evTimer_s _netReapTimer;
+
+/*!\brief timer used to resume accepting after running out of file descriptors */
+struct evTimer_s _netAcceptTimer;
 
 
 /*!\brief print hex dump of pointer packet to stdout
@@ -114,11 +131,408 @@ void netPakSend(int inSock, struct pak_s *p)
 }
 
 
+/*!\brief terminate all clients that have been marked for closing
+ * \param inCtx unused
+ * \return N/A
+ */
+void netCliReap(void *inCtx)
+{
+  struct netClientDat_s *cp;
+  struct netClientDat_s *next;
+
+  for (cp = _netCliList; cp != NULL; cp = next)
+    {
+      next = cp->next;
+      if (cp->closing)
+	{
+	  netSockTerm(cp);
+	}
+    }
+}
+
+
+/*!\brief mark client connection for closing
+ * \param cp pointer to client structure
+ * \return N/A
+ *
+ * The connection is terminated from the event loop, so callers that
+ * are iterating over the list of clients or still use cp are safe.
+ */
+void netCliClose(struct netClientDat_s *cp)
+{
+  if (cp->closing) return;
+
+  cp->closing = 1;
+  evTimerStart(&_netReapTimer, 0.0, 0.0, netCliReap, NULL);
+}
+
+
+/*!\brief number of broadcast packets handed to the kernel */
+unsigned long _netFanNum = 0;
+
+/*!\brief sum of the delays between broadcast and sending (s) */
+double _netFanSum = 0.0;
+
+/*!\brief max. delay between broadcast and sending (s) */
+double _netFanMax = 0.0;
+
+
+/*!\brief allocate buffer for an encoded packet
+ * \param len total length of packet including header
+ * \return pointer to buffer with one reference (NULL if out of memory)
+ */
+struct netBuf_s *netBufAlloc(int len)
+{
+  struct netBuf_s *b;
+
+  b = (struct netBuf_s*) malloc(sizeof(struct netBuf_s) + len);
+  if (b == NULL)
+    {
+      fprintf(stderr, "out of memory allocating output buffer\n");
+      return NULL;
+    }
+
+  b->ref  = 1;
+  b->len  = len;
+  b->time = 0.0;
+  b->data = (unsigned char*) (b + 1);
+
+  return b;
+}
+
+
+/*!\brief encode packet into a buffer that can be queued for several clients
+ * \param p pointer to packet structure
+ * \param reqId request ID to wrap the packet in a NET_REPLY (-1 = none)
+ * \return pointer to buffer with one reference (NULL if out of memory)
+ */
+struct netBuf_s *netBufNew(struct pak_s *p, int reqId)
+{
+  struct netBuf_s *b;
+  unsigned char *d;
+  int len;
+
+  assert(p != NULL);
+  assert((p->len == 0) || (p->data != NULL));
+
+  len = p->len + 3;
+  if (reqId >= 0) len += NET_REQ_HDR;
+
+  if (len - 3 > 0xFFFF)
+    {
+      fprintf(stderr, "packet too large for reply\n");
+      return NULL;
+    }
+
+  b = netBufAlloc(len);
+  if (b == NULL) return NULL;
+
+  d = b->data;
+  if (reqId >= 0)
+    {
+      /* NET_REPLY header, followed by request ID and type of the reply */
+      d[0] = NET_REPLY;
+      d[1] = (len - 3) >> 8;
+      d[2] = (len - 3) & 0xFF;
+      d[3] = reqId >> 8;
+      d[4] = reqId & 0xFF;
+      d[5] = p->type;
+      d += 3 + NET_REQ_HDR;
+    }
+  else
+    {
+      d[0] = p->type;
+      d[1] = p->len >> 8;
+      d[2] = p->len & 0xFF;
+      d += 3;
+    }
+
+  if (p->len > 0) memcpy(d, p->data, p->len);
+
+  return b;
+}
+
+
+/*!\brief release reference to buffer, free it if it was the last one
+ * \param b pointer to buffer
+ * \return N/A
+ */
+void netBufUnref(struct netBuf_s *b)
+{
+  assert(b->ref > 0);
+
+  b->ref--;
+  if (b->ref == 0) free(b);
+}
+
+
+/*!\brief remove element from output queue of client
+ * \param cp pointer to client structure
+ * \param n position of element in queue (0 = head)
+ * \return N/A
+ *
+ * The elements in front of the dropped one move up by one slot, so a
+ * partially sent head stays at the head.
+ */
+void netOutDrop(struct netClientDat_s *cp, int n)
+{
+  int head;
+  int idx;
+  int i;
+
+  assert(n >= 0 && cp->outNum > n);
+
+  head = cp->outHead;
+  idx  = (head + n) % cp->outMax;
+
+  netBufUnref(cp->outq[idx].buf);
+
+  for (i=n; i>0; i--)
+    {
+      cp->outq[(head + i) % cp->outMax] = cp->outq[(head + i - 1) % cp->outMax];
+    }
+
+  cp->outq[head].buf = NULL;
+  cp->outHead = (head + 1) % cp->outMax;
+  cp->outNum--;
+
+  if (n == 0) cp->outOff = 0;
+}
+
+
+/*!\brief send as much queued data to client as possible without blocking
+ * \param cp pointer to client structure
+ * \return N/A
+ *
+ * Up to NET_IOV_MAX queued packets are passed to the kernel with a
+ * single sendmsg() call. If not all data could be sent, the event loop
+ * is asked to report when the socket is writable again.
+ */
+void netCliFlush(struct netClientDat_s *cp)
+{
+  struct iovec iov[NET_IOV_MAX];
+  struct msghdr msg;
+  struct netBuf_s *b;
+  int ret;
+  int i;
+  int n;
+  double now;
+
+  while (cp->outNum > 0 && !cp->closing)
+    {
+      n = (cp->outNum < NET_IOV_MAX) ? cp->outNum : NET_IOV_MAX;
+
+      for (i=0; i<n; i++)
+	{
+	  b = cp->outq[(cp->outHead + i) % cp->outMax].buf;
+	  iov[i].iov_base = b->data;
+	  iov[i].iov_len  = b->len;
+	}
+      iov[0].iov_base = (unsigned char*) iov[0].iov_base + cp->outOff;
+      iov[0].iov_len -= cp->outOff;
+
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = n;
+
+      ret = sendmsg(cp->sf, &msg, MSG_DONTWAIT);
+      if (ret < 0)
+	{
+	  if (errno == EINTR) continue;
+	  if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+	  netCliClose(cp);
+	  return;
+	}
+
+      /* remove all packets that have been sent completely */
+      now = evTimeGet();
+      while (ret > 0)
+	{
+	  b = cp->outq[cp->outHead].buf;
+	  if (ret < b->len - cp->outOff)
+	    {
+	      cp->outOff += ret;
+	      break;
+	    }
+
+	  if (b->time > 0.0)
+	    {
+	      _netFanNum++;
+	      _netFanSum += now - b->time;
+	      if (now - b->time > _netFanMax) _netFanMax = now - b->time;
+	    }
+
+	  ret -= b->len - cp->outOff;
+	  netOutDrop(cp, 0);
+	}
+    }
+
+  if (!cp->closing)
+    {
+      evFdMod(cp->sf, (cp->outNum > 0) ? (EV_READ | EV_WRITE) : EV_READ);
+    }
+}
+
+
+/*!\brief queue encoded packet for sending to client connection
+ * \param cp pointer to client structure
+ * \param b pointer to buffer (a reference is taken if queued)
+ * \param key key used for coalescing status reports (0 = none)
+ * \return 0:OK, -1:packet dropped
+ *
+ * The packet is sent as soon as the socket accepts data, so this
+ * function never blocks. If the queue is full, _conf.netOverflow
+ * decides what happens. Only status broadcasts (key != 0) are dropped
+ * or replaced, replies and data base reports must reach the client
+ * complete. A client whose queue holds nothing else is disconnected.
+ */
+int netBufQueue(struct netClientDat_s *cp, struct netBuf_s *b, int key)
+{
+  struct netOut_s *op;
+  int i;
+  int n;
+
+  if (cp->closing) return -1;
+
+  if (cp->outNum == cp->outMax)
+    {
+      /* element at head is skipped if it has already been sent partially */
+      n = (cp->outOff > 0) ? 1 : 0;
+
+      if (_conf.netOverflow == NET_OVF_COALESCE && key != 0)
+	{
+	  for (i=n; i<cp->outNum; i++)
+	    {
+	      op = &cp->outq[(cp->outHead + i) % cp->outMax];
+	      if (op->key == key)
+		{
+		  /* replace older state report by the current one */
+		  netBufUnref(op->buf);
+		  op->buf = b;
+		  b->ref++;
+		  return 0;
+		}
+	    }
+	}
+
+      /* oldest status report that may be dropped */
+      for (i=n; i<cp->outNum; i++)
+	{
+	  if (cp->outq[(cp->outHead + i) % cp->outMax].key != 0) break;
+	}
+
+      if (_conf.netOverflow == NET_OVF_DISCONNECT || i >= cp->outNum)
+	{
+	  if (_conf.showTcpTraffic)
+	    {
+	      printf("output queue of client %i full, disconnecting\n", cp->id);
+	    }
+	  netCliClose(cp);
+	  return -1;
+	}
+
+      netOutDrop(cp, i);
+      cp->outDrops++;
+    }
+
+  op = &cp->outq[(cp->outHead + cp->outNum) % cp->outMax];
+  op->buf = b;
+  op->key = key;
+  b->ref++;
+  cp->outNum++;
+
+  netCliFlush(cp);
+
+  return 0;
+}
+
+
+/*!\brief queue packet for sending to client connection
+ * \param cp pointer to client structure
+ * \param p pointer to packet structure
+ * \param key key used for coalescing status reports (0 = none)
+ * \return 0:OK, -1:packet dropped
+ */
+int netPakQueue(struct netClientDat_s *cp, struct pak_s *p, int key)
+{
+  struct netBuf_s *b;
+  int ret;
+
+  if (cp->closing) return -1;
+
+  if (_conf.showTcpTraffic)
+    {
+      printf("NET>>> %i: ", cp->id);
+      netPakPrint(p);
+    }
+
+  b = netBufNew(p, cp->reqId);
+  if (b == NULL)
+    {
+      netCliClose(cp);
+      return -1;
+    }
+
+  /* replies to a request must not be replaced by broadcasts */
+  if (cp->reqId >= 0) key = 0;
+
+  ret = netBufQueue(cp, b, key);
+  netBufUnref(b);
+
+  return ret;
+}
+
+
+/*!\brief queue packet for sending to all subscribed client connections
+ * \param p pointer to packet structure
+ * \param key key used for coalescing status reports (0 = none)
+ * \param cls NET_SUB_xxx: event class of the packet
+ * \param module ID of LCN module the packet refers to
+ * \param output output of LCN module the packet refers to
+ * \return N/A
+ *
+ * The packet is encoded only once, all clients share the same buffer.
+ * Clients that are not subscribed to the module/output are skipped.
+ */
+void netPakBroadcast(struct pak_s *p, int key, int cls, int module, int output)
+{
+  struct netBuf_s *b;
+  struct netClientDat_s *cp;
+
+  for (cp = _netCliList; cp != NULL; cp = cp->next)
+    {
+      if (NET_CLI_WANTS(cp, cls, module, output)) break;
+    }
+  if (cp == NULL) return;
+
+  if (_conf.showTcpTraffic)
+    {
+      printf("NET>>> *: ");
+      netPakPrint(p);
+    }
+
+  b = netBufNew(p, -1);
+  if (b == NULL) return;
+  b->time = evTimeGet();
+
+  for ( ; cp != NULL; cp = cp->next)
+    {
+      if (NET_CLI_WANTS(cp, cls, module, output))
+	{
+	  netBufQueue(cp, b, key);
+	}
+    }
+
+  netBufUnref(b);
+}
+
+
 /*!\brief send packet containing local time to socket connection
- * \param inSock socket to send to
+ * \param cp client to send to
  * \return N/A
  */
-void netTimeSend(int inSock)
+void netTimeSend(struct netClientDat_s *cp)
 {
   uint32_t tm;
   struct pak_s pak;
@@ -129,15 +543,15 @@ void netTimeSend(int inSock)
   pak.len  = 4;
   pak.data = (unsigned char*) &tm;
 
-  netPakSend(inSock, &pak);
+  netPakQueue(cp, &pak, 0);
 }
 
 
 /*!\brief send packet containing local version to socket connection
- * \param inSock socket to send to
+ * \param cp client to send to
  * \return N/A
  */
-void netVersionSend(int inSock)
+void netVersionSend(struct netClientDat_s *cp)
 {
   int i;
   struct pak_s pak;
@@ -159,17 +573,17 @@ void netVersionSend(int inSock)
   pak.len  = 4+i;
   pak.data = _yaliBuf;
 
-  netPakSend(inSock, &pak);
+  netPakQueue(cp, &pak, 0);
 }
 
 
 /*!\brief send packet containing error report to socket connection
- * \param inSock socket to send to
+ * \param cp client to send to
  * \param code error code to send
  * \param text error string to send
  * \return N/A
  */
-void netErrorSend(int inSock, int code, char *text)
+void netErrorSend(struct netClientDat_s *cp, int code, char *text)
 {
   int i;
   struct pak_s pak;
@@ -189,18 +603,18 @@ void netErrorSend(int inSock, int code, char *text)
   pak.len  = i+2;
   pak.data = _yaliBuf;
 
-  netPakSend(inSock, &pak);
+  netPakQueue(cp, &pak, 0);
 }
 
 
 /*!\brief send packet containing light status report to socket connection
- * \param inSock socket to send to
+ * \param cp client to send to
  * \param module ID of LCN module the light is connected to
  * \param output output of LCN module the light is connected to
  * \param value state of the light 0(off) .. 100(on)
  * \return N/A
  */
-void netLightStatusSend(int inSock, int module, int output, int value)
+void netLightStatusSend(struct netClientDat_s *cp, int module, int output, int value)
 {
   struct pak_s pak;
   unsigned char buf[3];
@@ -213,18 +627,18 @@ void netLightStatusSend(int inSock, int module, int output, int value)
   pak.len  = 3;
   pak.data = buf;
 
-  netPakSend(inSock, &pak);
+  netPakQueue(cp, &pak, NET_KEY(NET_LIGHTSTATUSREPORT, module, output));
 }
 
 
 /*!\brief send packet containing shutter status report to socket connection
- * \param inSock socket to send to
+ * \param cp client to send to
  * \param module ID of LCN module the shutter is connected to
  * \param output output of LCN module the shutter is connected to
  * \param value state of the shutter 0(closed) .. 100(open)
  * \return N/A
  */
-void netShutStatusSend(int inSock, int module, int output, int value)
+void netShutStatusSend(struct netClientDat_s *cp, int module, int output, int value)
 {
   struct pak_s pak;
   unsigned char buf[3];
@@ -237,132 +651,669 @@ void netShutStatusSend(int inSock, int module, int output, int value)
   pak.len  = 3;
   pak.data = buf;
 
-  netPakSend(inSock, &pak);
+  netPakQueue(cp, &pak, NET_KEY(NET_SHUTSTATUSREPORT, module, output));
 }
 
 
-/*!\brief send packet containing light data base to socket connection
- * \param inSock socket to send to
+/*!\brief send light status report to all client connections
+ * \param module ID of LCN module the light is connected to
+ * \param output output of LCN module the light is connected to
+ * \param value state of the light 0(off) .. 100(on)
  * \return N/A
  */
-void netLightDbSend(int inSock)
+void netLightStatusBroadcast(int module, int output, int value)
 {
-  int len;
-  int y;
   struct pak_s pak;
-  struct lights_s *lp;
+  unsigned char buf[3];
 
-  len = 0;
+  buf[0] = module;
+  buf[1] = output;
+  buf[2] = value;
 
-  lp = _lights;
-  while (lp)
-    {
-      _yaliBuf[len] = lp->module;
-      _yaliBuf[len+1] = lp->output;
-      _yaliBuf[len+2] = lp->state;
+  pak.type = NET_LIGHTSTATUSREPORT;
+  pak.len  = 3;
+  pak.data = buf;
 
-      y = 0;
-      while (lp->name[y] != 0)
-	{
-	  _yaliBuf[len+3+y] = lp->name[y];
-	  y++;
-	}
-      _yaliBuf[len+3+y] = 0;
-      len += 4+y;
+  netPakBroadcast(&pak, NET_KEY(NET_LIGHTSTATUSREPORT, module, output),
+		  NET_SUB_LIGHT, module, output);
+}
 
-      lp = lp->next;
-    }
 
-  pak.type = NET_LIGHTDBREPORT;
-  pak.len = len;
-  pak.data = _yaliBuf;
+/*!\brief send shutter status report to all client connections
+ * \param module ID of LCN module the shutter is connected to
+ * \param output output of LCN module the shutter is connected to
+ * \param value state of the shutter 0(closed) .. 100(open)
+ * \return N/A
+ */
+void netShutStatusBroadcast(int module, int output, int value)
+{
+  struct pak_s pak;
+  unsigned char buf[3];
+
+  buf[0] = module;
+  buf[1] = output;
+  buf[2] = value;
+
+  pak.type = NET_SHUTSTATUSREPORT;
+  pak.len  = 3;
+  pak.data = buf;
 
-  netPakSend(inSock, &pak);
+  netPakBroadcast(&pak, NET_KEY(NET_SHUTSTATUSREPORT, module, output),
+		  NET_SUB_SHUTTER, module, output);
 }
 
 
-/*!\brief process received packet from TCP/IP socket
- * \param p pointer to packet structure
- * \param inSock socket this packet was received from
+/*!\brief send received LCN telegram to all clients subscribed to NET_SUB_RAW
+ * \param p pointer to LCN packet (as received, with CRC)
+ * \param inLen length of the packet
  * \return N/A
+ *
+ * The module filter of the subscription applies to the sending module,
+ * raw telegrams are never coalesced.
  */
-void netSockProc(struct pak_s *p, int inSock)
+void netRawBroadcast(unsigned char *p, int inLen)
 {
-  int tmp;
-  struct lights_s *lp;
-  struct pak_s *ptmp;
+  struct pak_s pak;
 
-  if (_conf.showTcpTraffic)
-    {
-      printf("NET<<< ");
-      netPakPrint(p);
-    }
+  if (inLen < 1) return;
 
-  switch (p->type)
-    {
-    case NET_EMPTY:
-      /* nothing to do */
-      break;
+  pak.type = NET_RAWRECEIVED;
+  pak.len  = inLen;
+  pak.data = p;
 
-    case NET_VERSIONGET:
-      netVersionSend(inSock);
-      break;
+  netPakBroadcast(&pak, 0, NET_SUB_RAW, _lcnBitRev[p[0]], 0);
+}
 
-    case NET_TIMEGET:
-      yaliTimeAdapt();
-      netTimeSend(inSock);
-      break;
 
-    case NET_LIGHTSTATUSSET:
-      if (_conf.lcnInterface)
+/*!\brief discard cached data base report
+ * \param c pointer to cache
+ * \return N/A
+ *
+ * Chunks still queued for clients are freed when they have been sent.
+ */
+void netDbCacheClear(struct netDbCache_s *c)
+{
+  int i;
+
+  for (i=0; i<c->num; i++)
+    {
+      netBufUnref(c->chunk[i]);
+    }
+
+  c->num = 0;
+  c->fill = 0;
+  c->valid = 0;
+}
+
+
+/*!\brief append entry to data base report that is being built
+ * \param c pointer to cache
+ * \param partType packet type used for chunks
+ * \param data pointer to entry
+ * \param len length of entry (at most NET_DB_CHUNK)
+ * \return 0:OK, -1:out of memory
+ *
+ * Entries are never split, a new chunk is started if the entry does
+ * not fit into the last one.
+ */
+int netDbCacheAdd(struct netDbCache_s *c, int partType, unsigned char *data, int len)
+{
+  struct netBuf_s **tmp;
+  struct netBuf_s *b;
+
+  assert(len <= NET_DB_CHUNK);
+
+  if (c->num == 0 || c->fill + len > NET_DB_CHUNK)
+    {
+      if (c->num == c->max)
 	{
-	  if (p->data[1]==1)
+	  tmp = (struct netBuf_s**) realloc(c->chunk, (c->max + 8) * sizeof(struct netBuf_s*));
+	  if (tmp == NULL) return -1;
+	  c->chunk = tmp;
+	  c->max += 8;
+	}
+
+      /* allocate full chunk, the length is adapted while it is filled */
+      b = netBufAlloc(NET_DB_CHUNK + 3);
+      if (b == NULL) return -1;
+
+      b->data[0] = partType;
+
+      c->chunk[c->num++] = b;
+      c->fill = 0;
+    }
+
+  b = c->chunk[c->num - 1];
+  if (len > 0) memcpy(&b->data[3 + c->fill], data, len);
+  c->fill += len;
+  b->len = c->fill + 3;
+  b->data[1] = c->fill >> 8;
+  b->data[2] = c->fill & 0xFF;
+
+  return 0;
+}
+
+
+/*!\brief locate the entry added last to a data base report
+ * \param c pointer to cache
+ * \param len length of the entry
+ * \return position of the entry for netDbCacheSet()
+ *
+ * The position stays valid until the cache is cleared.
+ */
+int netDbCacheLast(struct netDbCache_s *c, int len)
+{
+  return ((c->num - 1) << 16) | (3 + c->fill - len);
+}
+
+
+/*!\brief change one byte of a cached data base report
+ * \param c pointer to cache
+ * \param pos position as returned by netDbCacheLast() plus offset
+ * \param val new value of the byte
+ * \return 0:OK, -1:out of memory
+ *
+ * A chunk that is still queued for a client (ref > 1) may already be
+ * partially sent, so it is replaced by a copy instead of being patched.
+ */
+int netDbCacheSet(struct netDbCache_s *c, int pos, unsigned char val)
+{
+  struct netBuf_s *b;
+  struct netBuf_s *copy;
+
+  b = c->chunk[pos >> 16];
+  if (b->data[pos & 0xFFFF] == val) return 0;
+
+  if (b->ref > 1)
+    {
+      copy = netBufAlloc(NET_DB_CHUNK + 3);
+      if (copy == NULL) return -1;
+
+      memcpy(copy->data, b->data, b->len);
+      copy->len = b->len;
+
+      netBufUnref(b);
+      c->chunk[pos >> 16] = b = copy;
+    }
+
+  b->data[pos & 0xFFFF] = val;
+
+  return 0;
+}
+
+
+/*!\brief complete data base report that is being built
+ * \param c pointer to cache
+ * \param partType packet type used for chunks
+ * \param type packet type of the last chunk
+ * \return N/A
+ */
+void netDbCacheEnd(struct netDbCache_s *c, int partType, int type)
+{
+  if (c->num == 0)
+    {
+      /* empty data base, send one empty chunk */
+      if (netDbCacheAdd(c, partType, NULL, 0) != 0) return;
+    }
+
+  c->chunk[c->num - 1]->data[0] = type;
+  c->valid = 1;
+}
+
+
+/*!\brief queue cached data base report for client
+ * \param cp client to send to
+ * \param c pointer to cache
+ * \return N/A
+ */
+void netDbCacheSend(struct netClientDat_s *cp, struct netDbCache_s *c)
+{
+  struct netBuf_s *b;
+  struct pak_s pak;
+  int ret;
+  int i;
+
+  for (i=0; i<c->num; i++)
+    {
+      b = c->chunk[i];
+
+      if (cp->reqId >= 0)
+	{
+	  /* reply to a request, has to be wrapped individually */
+	  pak.type = b->data[0];
+	  pak.len  = b->len - 3;
+	  pak.data = &b->data[3];
+	  ret = netPakQueue(cp, &pak, 0);
+	}
+      else
+	{
+	  ret = netBufQueue(cp, b, 0);
+	}
+
+      if (ret != 0) break;
+    }
+}
+
+
+/*!\brief cached light data base report */
+struct netDbCache_s _netLightDb;
+
+
+/*!\brief send packet(s) containing light data base to socket connection
+ * \param cp client to send to
+ * \return N/A
+ *
+ * The report is built once and kept until a light is added, the
+ * current states are written into it before it is sent.
+ */
+void netLightDbSend(struct netClientDat_s *cp)
+{
+  int y;
+  unsigned char buf[NET_DB_CHUNK];
+  struct lights_s *lp;
+
+  if (!_netLightDb.valid)
+    {
+      netDbCacheClear(&_netLightDb);
+
+      for (lp = _lights; lp != NULL; lp = lp->next)
+	{
+	  buf[0] = lp->module;
+	  buf[1] = lp->output;
+	  buf[2] = lp->state;
+
+	  y = 0;
+	  while (lp->name[y] != 0 && y < NET_DB_CHUNK-4)
 	    {
-	      tmp = p->data[2];
-	      if (tmp>100) tmp = 100;
-	      tmp = tmp/2;
-	      
-	      lcnQueueCommandSend(_lcnSerFd, p->data[0], 4, tmp, 4);
+	      buf[3+y] = lp->name[y];
+	      y++;
 	    }
-	  else if (p->data[1]==2)
+	  buf[3+y] = 0;
+
+	  if (netDbCacheAdd(&_netLightDb, NET_LIGHTDBPART, buf, 4+y) != 0)
 	    {
-	      tmp = p->data[2];
-	      if (tmp>100) tmp = 100;
-	      tmp = tmp/2;
-	      
-	      lcnQueueCommandSend(_lcnSerFd, p->data[0], 5, tmp, 4);
+	      fprintf(stderr, "out of memory building light data base\n");
+	      netDbCacheClear(&_netLightDb);
+	      return;
 	    }
-	  else if (p->data[1]==3)
+	  lp->dbState = netDbCacheLast(&_netLightDb, 4+y) + 2;
+	}
+
+      netDbCacheEnd(&_netLightDb, NET_LIGHTDBPART, NET_LIGHTDBREPORT);
+    }
+  else
+    {
+      for (lp = _lights; lp != NULL; lp = lp->next)
+	{
+	  if (netDbCacheSet(&_netLightDb, lp->dbState, lp->state) != 0)
 	    {
-	      tmp = p->data[2];
-	      if (tmp>100) tmp = 100;
-	      tmp = tmp/2;
-	      
-	      lcnQueueCommandSend(_lcnSerFd, p->data[0], 3, tmp, 4);
+	      fprintf(stderr, "out of memory updating light data base\n");
+	      netDbCacheClear(&_netLightDb);
+	      return;
 	    }
 	}
+    }
+
+  netDbCacheSend(cp, &_netLightDb);
+}
+
+
+/*!\brief switch light (queue LCN command or update state in test mode)
+ * \param module ID of LCN module the light is connected to
+ * \param output output of LCN module the light is connected to
+ * \param value new state of the light 0(off) .. 100(on)
+ * \return 0:OK, -1:LCN send queue full
+ */
+int netLightSet(int module, int output, int value)
+{
+  int cmd;
+
+  if (_conf.lcnInterface)
+    {
+      if (output==1) cmd = 4;
+      else if (output==2) cmd = 5;
+      else if (output==3) cmd = 3;
+      else return 0;
+
+      if (value>100) value = 100;
+
+      return lcnQueueCommandSend(_lcnSerFd, module, cmd, value/2, 4, LCN_PRIO_USER);
+    }
+
+  /* operation with out LCN (test mode) */
+  stateLightUpdate(module, output, value);
+  return 0;
+}
+
+
+/*!\brief queue a bulk report
+ * \param cp client to send to
+ * \param inType NET_LIGHTBULKREPORT or NET_SHUTBULKREPORT
+ * \param buf entries (module, output, value)
+ * \param inLen length of the entries
+ * \return 0:OK, -1:packet dropped
+ */
+int netBulkFlush(struct netClientDat_s *cp, int inType, unsigned char *buf, int inLen)
+{
+  struct pak_s pak;
+
+  pak.type = inType;
+  pak.len  = inLen;
+  pak.data = buf;
+
+  return netPakQueue(cp, &pak, 0);
+}
+
+
+/*!\brief add an entry to a bulk report, queue the report when it is full
+ * \param cp client to send to
+ * \param inType NET_LIGHTBULKREPORT or NET_SHUTBULKREPORT
+ * \param buf entries collected so far
+ * \param len length of the entries collected so far (updated)
+ * \param inSize size of buf
+ * \param inModule module
+ * \param inOutput output or shutter number
+ * \param inValue state
+ * \return 0:OK, -1:client has been closed
+ */
+int netBulkAdd(struct netClientDat_s *cp, int inType, unsigned char *buf, int *len,
+	       int inSize, int inModule, int inOutput, int inValue)
+{
+  if (*len + 3 > inSize)
+    {
+      netBulkFlush(cp, inType, buf, *len);
+      if (cp->closing) return -1;
+      *len = 0;
+    }
+
+  buf[*len]   = inModule;
+  buf[*len+1] = inOutput;
+  buf[*len+2] = inValue;
+  *len += 3;
+
+  return 0;
+}
+
+
+/*!\brief send bulk report with state of several lights to client
+ * \param cp client to send to
+ * \param p pointer to NET_LIGHTBULKGET packet
+ * \return N/A
+ *
+ * Unknown lights are left out of the report. Reports with more than
+ * NET_BULK_MAX entries are split into several packets.
+ */
+void netLightBulkSend(struct netClientDat_s *cp, struct pak_s *p)
+{
+  struct lights_s *lp;
+  unsigned char *buf;
+  int size;
+  int len;
+  int i;
+
+  size = 0;
+  if (p->len >= 2) size = p->len / 2;
+  else for (lp = _lights; lp != NULL; lp = lp->next) size++;
+  if (size > NET_BULK_MAX) size = NET_BULK_MAX;
+  size *= 3;
+
+  buf = (unsigned char*) malloc(size + 1);
+  if (buf == NULL)
+    {
+      fprintf(stderr, "out of memory allocating bulk report\n");
+      return;
+    }
+
+  len = 0;
+  if (p->len >= 2)
+    {
+      for (i=0; i+2<=p->len; i+=2)
+	{
+	  lp = confLightFind(p->data[i], p->data[i+1]);
+	  if (lp == NULL) continue;
+
+	  if (netBulkAdd(cp, NET_LIGHTBULKREPORT, buf, &len, size,
+			 lp->module, lp->output, lp->state) != 0) break;
+	}
+    }
+  else
+    {
+      for (lp = _lights; lp != NULL; lp = lp->next)
+	{
+	  if (netBulkAdd(cp, NET_LIGHTBULKREPORT, buf, &len, size,
+			 lp->module, lp->output, lp->state) != 0) break;
+	}
+    }
+
+  if (!cp->closing) netBulkFlush(cp, NET_LIGHTBULKREPORT, buf, len);
+
+  free(buf);
+}
+
+
+/*!\brief send bulk report with state of several shutters to client
+ * \param cp client to send to
+ * \param p pointer to NET_SHUTBULKGET packet
+ * \return N/A
+ *
+ * Unknown shutters are left out of the report. Reports with more than
+ * NET_BULK_MAX entries are split into several packets.
+ */
+void netShutBulkSend(struct netClientDat_s *cp, struct pak_s *p)
+{
+  struct shutter_s *sp;
+  unsigned char *buf;
+  int size;
+  int len;
+  int i;
+
+  size = 0;
+  if (p->len >= 2) size = p->len / 2;
+  else for (sp = _stateShutRoot; sp != NULL; sp = sp->next) size++;
+  if (size > NET_BULK_MAX) size = NET_BULK_MAX;
+  size *= 3;
+
+  buf = (unsigned char*) malloc(size + 1);
+  if (buf == NULL)
+    {
+      fprintf(stderr, "out of memory allocating bulk report\n");
+      return;
+    }
+
+  len = 0;
+  if (p->len >= 2)
+    {
+      for (i=0; i+2<=p->len; i+=2)
+	{
+	  sp = stateShutPtrGet(p->data[i], p->data[i+1]);
+	  if (sp == NULL) continue;
+
+	  if (netBulkAdd(cp, NET_SHUTBULKREPORT, buf, &len, size, sp->module, sp->rnum,
+			 stateShutGet(sp->module, sp->rnum)) != 0) break;
+	}
+    }
+  else
+    {
+      for (sp = _stateShutRoot; sp != NULL; sp = sp->next)
+	{
+	  if (netBulkAdd(cp, NET_SHUTBULKREPORT, buf, &len, size, sp->module, sp->rnum,
+			 stateShutGet(sp->module, sp->rnum)) != 0) break;
+	}
+    }
+
+  if (!cp->closing) netBulkFlush(cp, NET_SHUTBULKREPORT, buf, len);
+
+  free(buf);
+}
+
+
+/*!\brief set event subscription of client
+ * \param cp client the subscription request was received from
+ * \param p pointer to NET_SUBSCRIBE packet
+ * \return N/A
+ *
+ * The first byte of the payload is the mask of subscribed event classes,
+ * it is followed by a list of filter entries. Each entry is either
+ * NET_SUB_MODULES followed by first module, last module and output mask,
+ * or NET_SUB_TAG followed by the zero terminated name of a configured
+ * tag. Without entries all modules are subscribed. On error the previous
+ * subscription is kept.
+ */
+void netSubscribe(struct netClientDat_s *cp, struct pak_s *p)
+{
+  unsigned char subOut[256];
+  struct confTag_s *tp;
+  int first;
+  int last;
+  int mask;
+  int i;
+  int y;
+
+  if (p->len < 1)
+    {
+      netErrorSend(cp, NET_ERR_ILLDATA, "subscription without class mask");
+      return;
+    }
+
+  memset(subOut, (p->len == 1) ? 0xFF : 0, sizeof(subOut));
+
+  i = 1;
+  while (i < p->len)
+    {
+      if (p->data[i] == NET_SUB_MODULES && i+3 < p->len)
+	{
+	  first = p->data[i+1];
+	  last  = p->data[i+2];
+	  mask  = p->data[i+3];
+	  i += 4;
+	}
+      else if (p->data[i] == NET_SUB_TAG)
+	{
+	  y = i+1;
+	  while (y < p->len && p->data[y] != 0) y++;
+	  if (y == p->len)
+	    {
+	      netErrorSend(cp, NET_ERR_ILLDATA, "unterminated tag");
+	      return;
+	    }
+
+	  tp = confTagFind((char*) &p->data[i+1]);
+	  if (tp == NULL)
+	    {
+	      netErrorSend(cp, NET_ERR_ILLDATA, "unknown tag");
+	      return;
+	    }
+
+	  first = tp->first;
+	  last  = tp->last;
+	  mask  = 0xFF;
+	  i = y+1;
+	}
       else
 	{
-	  /* operation with out LCN (test mode) */
-	  stateLightUpdate(p->data[0], p->data[1], p->data[2]);
+	  netErrorSend(cp, NET_ERR_ILLDATA, "illegal subscription entry");
+	  return;
 	}
+
+      for (y = first; y <= last; y++)
+	{
+	  subOut[y] |= mask;
+	}
+    }
+
+  cp->subClass = p->data[0];
+  memcpy(cp->subOut, subOut, sizeof(subOut));
+}
+
+
+/*!\brief process received packet from TCP/IP socket
+ * \param p pointer to packet structure
+ * \param cp client this packet was received from
+ * \return N/A
+ */
+void netSockProc(struct pak_s *p, struct netClientDat_s *cp)
+{
+  int tmp;
+  struct lights_s *lp;
+  struct pak_s *ptmp;
+  struct pak_s inner;
+
+  if (_conf.showTcpTraffic)
+    {
+      printf("NET<<< ");
+      netPakPrint(p);
+    }
+
+  switch (p->type)
+    {
+    case NET_EMPTY:
+      /* nothing to do */
+      break;
+
+    case NET_VERSIONGET:
+      netVersionSend(cp);
+      break;
+
+    case NET_TIMEGET:
+      yaliTimeAdapt();
+      netTimeSend(cp);
+      break;
+
+    case NET_LIGHTSTATUSSET:
+      if (p->len < 3)
+	{
+	  netErrorSend(cp, NET_ERR_ILLDATA, "light set without module, output and value");
+	  break;
+	}
+      if (netLightSet(p->data[0], p->data[1], p->data[2]) != 0)
+	{
+	  netErrorSend(cp, NET_ERR_BUSY, "LCN send queue full");
+	}
+      break;
+
+    case NET_LIGHTBULKSET:
+      /* the batch is applied completely or not at all */
+      if (p->len % 3 != 0 || p->len / 3 > LCN_QUEUE_LEN)
+	{
+	  netErrorSend(cp, NET_ERR_ILLDATA, "light bulk set with incomplete entry or too many entries");
+	  break;
+	}
+      if (_conf.lcnInterface && lcnQueueFree(LCN_PRIO_USER) < p->len / 3)
+	{
+	  netErrorSend(cp, NET_ERR_BUSY, "LCN send queue full");
+	  break;
+	}
+      lcnQueueBatchBegin();
+      for (tmp=0; tmp+3<=p->len; tmp+=3)
+	{
+	  netLightSet(p->data[tmp], p->data[tmp+1], p->data[tmp+2]);
+	}
+      lcnQueueBatchEnd();
+      break;
+
+    case NET_LIGHTBULKGET:
+      netLightBulkSend(cp, p);
       break;
 
     case NET_LIGHTSTATUSGET:
-      lp = _lights;
-      while (lp)
+      if (p->len < 2)
 	{
-	  if (p->data[0] == lp->module
-	      && p->data[1] == lp->output)
-	    {
-	      netLightStatusSend(inSock, lp->module, lp->output, lp->state);
-	      break;
-	    }
-	  lp = lp->next;
+	  netErrorSend(cp, NET_ERR_ILLDATA, "light get without module and output");
+	  break;
+	}
+      lp = confLightFind(p->data[0], p->data[1]);
+      if (lp != NULL)
+	{
+	  netLightStatusSend(cp, lp->module, lp->output, lp->state);
 	}
       break;
 
     case NET_SHUTSTATUSSET:
+      if (p->len < 4)
+	{
+	  netErrorSend(cp, NET_ERR_ILLDATA, "shutter set without module, number and position");
+	  break;
+	}
       if (_conf.lcnInterface)
 	{
 	  struct shutter_s *sp;
@@ -391,220 +1342,473 @@ void netSockProc(struct pak_s *p, int inSock)
       break;
 
     case NET_SHUTSTATUSGET:
-      tmp = stateShutGet(lp->module, lp->output);
+      if (p->len < 2)
+	{
+	  netErrorSend(cp, NET_ERR_ILLDATA, "shutter get without module and number");
+	  break;
+	}
+      tmp = stateShutGet(p->data[0], p->data[1]);
       if (tmp >= 0)
 	{
-	  netShutStatusSend(inSock, lp->module, lp->output, tmp);
+	  netShutStatusSend(cp, p->data[0], p->data[1], tmp);
+	}
+      break;
+
+    case NET_SHUTBULKSET:
+      /* the batch is applied completely or not at all */
+      for (tmp=0; tmp+4<=p->len; tmp+=4)
+	{
+	  if (p->data[tmp+2] > p->data[tmp+3]
+	      || stateShutPtrGet(p->data[tmp], p->data[tmp+1]) == NULL) break;
+	}
+      if (tmp != p->len)
+	{
+	  netErrorSend(cp, NET_ERR_ILLDATA, "shutter bulk set with illegal entry");
+	  break;
+	}
+      if (_conf.lcnInterface)
+	{
+	  lcnQueueBatchBegin();
+	  for (tmp=0; tmp+4<=p->len; tmp+=4)
+	    {
+	      stateShutCommand(p->data[tmp], p->data[tmp+1],
+			       p->data[tmp+2], p->data[tmp+3]);
+	    }
+	  lcnQueueBatchEnd();
 	}
       break;
 
+    case NET_SHUTBULKGET:
+      netShutBulkSend(cp, p);
+      break;
+
     case NET_SHUTTERDBGET:
-      stateShutDbSend(inSock);
+      stateShutDbSend(cp);
       break;
 
     case NET_LIGHTDBGET:
-      netLightDbSend(inSock);
+      netLightDbSend(cp);
       break;
 
     case NET_NETHISTGET:
       ptmp = stateLightHistGet();
-      netPakSend(inSock, ptmp);
+      netPakQueue(cp, ptmp, 0);
+      netPakFree(ptmp);
+      ptmp = NULL;
+      break;
+
+    case NET_SYNCGET:
+      if (p->len < 8)
+	{
+	  netErrorSend(cp, NET_ERR_ILLDATA, "sync without epoch and sequence number");
+	  break;
+	}
+      ptmp = stateSyncGet(((unsigned long) p->data[0] << 24) | (p->data[1] << 16)
+			  | (p->data[2] << 8) | p->data[3],
+			  ((unsigned long) p->data[4] << 24) | (p->data[5] << 16)
+			  | (p->data[6] << 8) | p->data[7]);
+      if (ptmp != NULL) netPakQueue(cp, ptmp, 0);
       netPakFree(ptmp);
       ptmp = NULL;
       break;
 
+    case NET_SUBSCRIBE:
+      netSubscribe(cp, p);
+      break;
+
+    case NET_REQUEST:
+      if (p->len < NET_REQ_HDR || cp->reqId >= 0)
+	{
+	  netErrorSend(cp, NET_ERR_ILLDATA, "illegal request envelope");
+	  break;
+	}
+
+      /* process wrapped packet, replies are wrapped with the same ID */
+      ptmp = &inner;
+      ptmp->type = p->data[2];
+      ptmp->len  = p->len - NET_REQ_HDR;
+      ptmp->data = &p->data[NET_REQ_HDR];
+
+      cp->reqId = (p->data[0] << 8) | p->data[1];
+      netSockProc(ptmp, cp);
+      cp->reqId = -1;
+      ptmp = NULL;
+      break;
+
     default:
       /* unknown type */
-      netErrorSend(inSock, NET_ERR_ILLTYPE, "received illegal code");
+      netErrorSend(cp, NET_ERR_ILLTYPE, "received illegal code");
       break;
     }
 }
 
 
+/*!\brief get an unused client structure
+ * \return pointer to client structure (NULL if out of memory)
+ *
+ * Client structures are allocated in slabs of NET_CLI_SLAB elements
+ * and never freed, unused ones are kept in a free list.
+ */
+struct netClientDat_s *netCliAlloc(void)
+{
+  struct netClientDat_s *cp;
+  int i;
+
+  if (_netCliFree == NULL)
+    {
+      cp = (struct netClientDat_s*) malloc(NET_CLI_SLAB * sizeof(struct netClientDat_s));
+      if (cp == NULL)
+	{
+	  fprintf(stderr, "out of memory allocating client table\n");
+	  return NULL;
+	}
+
+      for (i=0; i<NET_CLI_SLAB; i++)
+	{
+	  cp[i].sf = -1;
+	  cp[i].outq = NULL;
+	  cp[i].rcbuf = NULL;
+	  cp[i].next = _netCliFree;
+	  _netCliFree = &cp[i];
+	}
+    }
+
+  if (_netCliFree->outq == NULL)
+    {
+      _netCliFree->outq = (struct netOut_s*) calloc(_conf.netOutQueueLen, sizeof(struct netOut_s));
+      if (_netCliFree->outq == NULL)
+	{
+	  fprintf(stderr, "out of memory allocating output queue\n");
+	  return NULL;
+	}
+    }
+
+  if (_netCliFree->rcbuf == NULL)
+    {
+      _netCliFree->rcbuf = (unsigned char*) malloc(NET_RCBUF_SIZE);
+      if (_netCliFree->rcbuf == NULL)
+	{
+	  fprintf(stderr, "out of memory allocating receive buffer\n");
+	  return NULL;
+	}
+      _netCliFree->rcsize = NET_RCBUF_SIZE;
+    }
+
+  cp = _netCliFree;
+  _netCliFree = cp->next;
+
+  cp->rcstart = 0;
+  cp->rcpos = 0;
+  cp->sf = -1;
+  cp->id = _netCliId++;
+  cp->closing = 0;
+  cp->reqId = -1;
+  cp->outMax = _conf.netOutQueueLen;
+  cp->outHead = 0;
+  cp->outNum = 0;
+  cp->outOff = 0;
+  cp->outDrops = 0;
+  cp->subClass = NET_SUB_DEFAULT;
+  memset(cp->subOut, 0xFF, sizeof(cp->subOut));
+
+  /* add to list of active clients */
+  cp->prev = NULL;
+  cp->next = _netCliList;
+  if (_netCliList) _netCliList->prev = cp;
+  _netCliList = cp;
+  _netCliNum++;
+
+  return cp;
+}
+
+
+/*!\brief remove client from list of active clients and put it to the free list
+ * \param cp pointer to client structure
+ * \return N/A
+ */
+void netCliRelease(struct netClientDat_s *cp)
+{
+  if (cp->prev) cp->prev->next = cp->next;
+  else _netCliList = cp->next;
+  if (cp->next) cp->next->prev = cp->prev;
+  _netCliNum--;
+
+  while (cp->outNum > 0)
+    {
+      netOutDrop(cp, 0);
+    }
+
+  /* do not keep buffers enlarged by large packets */
+  if (cp->rcsize > NET_RCBUF_SIZE)
+    {
+      free(cp->rcbuf);
+      cp->rcbuf = NULL;
+    }
+
+  cp->sf = -1;
+  cp->prev = NULL;
+  cp->next = _netCliFree;
+  _netCliFree = cp;
+}
+
+
 /*!\brief close TCP/IP connection and remove from list of open connections
- * \param inN index to client table
+ * \param cp pointer to client structure
  * \return N/A
  */
-void netSockTerm(int inN)
+void netSockTerm(struct netClientDat_s *cp)
 {
-  assert(inN >= 0);
-  assert(inN < CLI_NUM);
-  assert(_cli[inN].sf != -1);
+  assert(cp != NULL);
+  assert(cp->sf != -1);
 
   if (_conf.showTcpTraffic)
     {
-      printf("terminate client %i\n", inN);
+      printf("terminate client %i", cp->id);
+      if (cp->outDrops) printf(" (%i packets dropped)", cp->outDrops);
+      printf("\n");
     }
 
-  close(_cli[inN].sf);
+  evFdDel(cp->sf);
+  close(cp->sf);
 
-  _cli[inN].sf = -1;
-  _cli[inN].rcpos = 0;
-  _cli[inN].dummy = 0;
+  netCliRelease(cp);
 }
 
 
-/*!\brief read arbitrary number of bytes from socket connection
- * \param inN index to client table
+/*!\brief make room for at least one more packet in receive buffer
+ * \param cp pointer to client structure
+ * \return 0:OK, -1:out of memory
+ *
+ * The unprocessed bytes (at most one incomplete packet) are moved to
+ * the start of the buffer. If the packet does not fit into the buffer,
+ * the buffer is enlarged to the size of the packet.
+ */
+int netRcBufCompact(struct netClientDat_s *cp)
+{
+  unsigned char *tmp;
+  int avail;
+  int need;
+  int size;
+
+  avail = cp->rcpos - cp->rcstart;
+
+  if (cp->rcstart > 0)
+    {
+      memmove(cp->rcbuf, &cp->rcbuf[cp->rcstart], avail);
+      cp->rcstart = 0;
+      cp->rcpos = avail;
+    }
+
+  if (avail < 3) return 0;
+
+  need = ((cp->rcbuf[1] << 8) | cp->rcbuf[2]) + 3;
+  if (need <= cp->rcsize) return 0;
+
+  size = cp->rcsize;
+  while (size < need) size *= 2;
+  if (size > NET_RCBUF_MAX) size = NET_RCBUF_MAX;
+
+  tmp = (unsigned char*) realloc(cp->rcbuf, size);
+  if (tmp == NULL)
+    {
+      fprintf(stderr, "out of memory allocating receive buffer\n");
+      return -1;
+    }
+
+  cp->rcbuf = tmp;
+  cp->rcsize = size;
+
+  return 0;
+}
+
+
+/*!\brief read all available bytes from socket connection
+ * \param cp pointer to client structure
  * \return N/A
  *
- * As soon as a packet is completed the function netSockProc is called
- * with the received packet.
+ * All complete packets in the receive buffer are passed to netSockProc
+ * in place, the buffer is only compacted when no space is left at its
+ * end. The socket is read until no more data is available, as the event
+ * loop only reports new data once (edge triggered).
  */
-void netSockDataGet(int inN)
+void netSockDataGet(struct netClientDat_s *cp)
 {
-  unsigned char *rcbuf;
-  int rcpos;
+  unsigned char *rp;
   int ret;
-  int i;
   int len;
   struct pak_s pak;
-  unsigned char dummybuf[128];
-  int dummy;
-  int inSock;
-  
-  assert(inN >= 0);
-  assert(inN < CLI_NUM);
-  assert(_cli[inN].sf != -1);
-
-  inSock = _cli[inN].sf;
-  rcbuf = _cli[inN].rcbuf;
-  rcpos = _cli[inN].rcpos;
-  dummy = _cli[inN].dummy;
 
-  /*printf("%i: rcpos=%i\n", inN, rcpos);*/
+  assert(cp != NULL);
+  assert(cp->sf != -1);
 
-  if (rcpos >= 128)
+  while (!cp->closing)
     {
-      len = (pak.len + 3) - rcpos - dummy;
-      assert(len>0);
-      if (len>128) len = 128;
-      ret = recv(inSock, dummybuf, len, 0);
-      if (ret > 0)
+      if (cp->rcpos == cp->rcsize)
 	{
-	  /*printf("received %i dummy-bytes from client %i\n", ret, inN);*/
-	  dummy += ret;
-	  len = (pak.len + 3) - rcpos - dummy;
-	  if (len==0)
+	  if (netRcBufCompact(cp) != 0)
 	    {
-	      /*printf("<<< consumed illegal packet (len=%i)\n", pak.len);*/
-	      rcpos = 0;
-	      dummy = 0;
+	      netSockTerm(cp);
+	      return;
 	    }
 	}
-      else
-	{
-	  netSockTerm(inN);
-	  rcpos = 0;
-	  dummy = 0;
-	}
-    }
 
-  ret = recv(inSock, &rcbuf[rcpos], 128 - rcpos, 0);
-  if (ret > 0)
-    {
-      /*printf("received %i bytes from client %i\n", ret, inN);*/
-      rcpos += ret;
-      
-      while (rcpos >= 3)
+      ret = recv(cp->sf, &cp->rcbuf[cp->rcpos], cp->rcsize - cp->rcpos, MSG_DONTWAIT);
+      if (ret > 0)
 	{
-	  pak.type  = rcbuf[0];
-	  pak.len   = (rcbuf[1]<<8) + rcbuf[2];
-	  pak.data  = &rcbuf[3];
+	  /*printf("received %i bytes from client %i\n", ret, cp->id);*/
+	  cp->rcpos += ret;
 
-	  len = pak.len + 3;
-	  if (rcpos >= len)
+	  while (cp->rcpos - cp->rcstart >= 3 && !cp->closing)
 	    {
-	      netSockProc(&pak, inSock);
-	      for (i=len; i<rcpos; i++)
-		{
-		  rcbuf[i-len] = rcbuf[i];
-		}
-	      rcpos -= len;
+	      rp = &cp->rcbuf[cp->rcstart];
+
+	      pak.type  = rp[0];
+	      pak.len   = (rp[1]<<8) + rp[2];
+	      pak.data  = &rp[3];
+
+	      len = pak.len + 3;
+	      if (cp->rcpos - cp->rcstart < len) break;
+
+	      cp->rcstart += len;
+	      netSockProc(&pak, cp);
 	    }
-	  else
+
+	  if (cp->rcstart == cp->rcpos)
 	    {
-	      break;
+	      cp->rcstart = 0;
+	      cp->rcpos = 0;
 	    }
 	}
+      else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+	  break;
+	}
+      else if (ret < 0 && errno == EINTR)
+	{
+	  continue;
+	}
+      else
+	{
+	  netSockTerm(cp);
+	  return;
+	}
     }
-  else
+}
+
+
+/*!\brief event handler for client connections
+ * \param inFd socket of the client
+ * \param inEvents events reported by the event loop
+ * \param inCtx pointer to client structure
+ * \return N/A
+ */
+void netClientEvent(int inFd, int inEvents, void *inCtx)
+{
+  struct netClientDat_s *cp;
+
+  cp = (struct netClientDat_s*) inCtx;
+
+  if (cp->closing) return;
+
+  if (inEvents & EV_WRITE)
+    {
+      netCliFlush(cp);
+    }
+
+  if (inEvents & EV_READ)
+    {
+      netSockDataGet(cp);
+    }
+  else if (inEvents & EV_ERROR)
     {
-      netSockTerm(inN);
-      rcpos = 0;
-      dummy = 0;
+      fprintf(stderr, "error on client %i\n", cp->id);
+      netCliClose(cp);
     }
+}
 
-  _cli[inN].rcpos = rcpos;
-  _cli[inN].dummy = dummy;
 
-  /*printf("%i after rcpos=%i\n", inN, rcpos);*/
+/*!\brief timer function resuming accepting clients (see netClientAccept)
+ * \param inCtx server socket
+ * \return N/A
+ */
+void netAcceptResume(void *inCtx)
+{
+  int srvSock = (int) (long) inCtx;
+
+  evFdMod(srvSock, EV_READ);
+  netClientAccept(srvSock);
 }
 
 
-/*!\brief accept a possbly pending client connection
+/*!\brief accept all pending client connections
  * \param srcSock socket where connections are to be accepted
  * \return N/A
  *
  * When a new client has been accepted, the client is added to the
- * list of open connections.
+ * list of open connections. The client table grows on demand, clients
+ * are only refused if no memory is left. If the server runs out of
+ * file descriptors, accepting is paused for NET_ACCEPT_PAUSE seconds.
  */
 void netClientAccept(int srvSock)
 {
   int sock;
   socklen_t sLen;
   struct sockaddr_in tmpClient;
-  int idx;
-  int i;
-
-  sLen = sizeof(tmpClient);
+  struct netClientDat_s *cp;
+  struct pak_s pak;
 
-  idx = -1;
-  for (i=0; i<CLI_NUM; i++)
+  while (1)
     {
-      if (_cli[i].sf == -1)
-	{
-	  idx = i;
-	  break;
-	}
-    }
+      sLen = sizeof(tmpClient);
 
-  /*printf("idx=%i\n", idx);*/
-
-  if (idx == -1)
-    {
       sock = accept(srvSock, (struct sockaddr *) &tmpClient, &sLen);
       if (sock == -1)
 	{
-	  if (errno==EWOULDBLOCK) return;
+	  if (errno==EWOULDBLOCK || errno==EAGAIN) return;
+	  if (errno==EINTR || errno==ECONNABORTED || errno==EPROTO) continue;
 
 	  perror("accept srvSock failed");
-	  exit(1);
+
+	  if (errno==EMFILE || errno==ENFILE)
+	    {
+	      /* the pending connection stays ready, don't poll it until
+		 some descriptors may have been released */
+	      evFdMod(srvSock, 0);
+	      evTimerStart(&_netAcceptTimer, NET_ACCEPT_PAUSE, 0.0,
+			   netAcceptResume, (void*) (long) srvSock);
+	    }
+	  return;
 	}
-      netErrorSend(sock, NET_ERR_SERVERFULL, "too many clients");
-      close(sock);
 
-      if (_conf.showTcpTraffic)
+      cp = netCliAlloc();
+      if (cp == NULL)
 	{
-	  printf("Client refused\n");
+	  pak.type = NET_ERRORREPORT;
+	  pak.len  = 18;
+	  pak.data = (unsigned char*) "\001too many clients";
+	  netPakSend(sock, &pak);
+	  close(sock);
+
+	  if (_conf.showTcpTraffic)
+	    {
+	      printf("Client refused\n");
+	    }
+	  continue;
 	}
-    }
-  else
-    {
-      sock = accept(srvSock, (struct sockaddr *) &_cli[idx].sa, &sLen);
-      if (sock == -1)
-	{
-	  if (errno==EWOULDBLOCK) return;
 
-	  perror("accept srvSock failed");
-	  exit(1);
+      if (evFdAdd(sock, EV_READ, netClientEvent, cp) != 0)
+	{
+	  netCliRelease(cp);
+	  close(sock);
+	  continue;
 	}
 
-      _cli[idx].sf = sock;
+      cp->sf = sock;
+      cp->sa = tmpClient;
 
       if (_conf.showTcpTraffic)
 	{
-	  printf("Client %i accepted\n", idx);
+	  printf("Client %i accepted (%i connected)\n", cp->id, _netCliNum);
 	}
     }
 }
@@ -615,19 +1819,11 @@ void netClientAccept(int srvSock)
  */
 int netServerOpen()
 {
-  int i;
   int srvSock;
   socklen_t sLen;
   struct sockaddr_in srv;
   int tmp;
 
-  for (i=0; i<CLI_NUM; i++)
-    {
-      _cli[i].rcpos = 0;
-      _cli[i].dummy = 0;
-      _cli[i].sf = -1;
-    }
-
   stateBufInit();
 
   srvSock = socket(AF_INET, SOCK_STREAM, 0);
@@ -35,6 +35,13 @@ with this program; if not, see <http://www.gnu.org/licenses/>.
 #define NET_NETHISTGET        0x07
 #define NET_SHUTSTATUSGET     0x08
 #define NET_SHUTSTATUSSET     0x09
+#define NET_SUBSCRIBE         0x0A
+#define NET_REQUEST           0x0B
+#define NET_LIGHTBULKGET      0x0C
+#define NET_LIGHTBULKSET      0x0D
+#define NET_SHUTBULKGET       0x0E
+#define NET_SHUTBULKSET       0x0F
+#define NET_SYNCGET           0x10
 #define NET_VERSIONREPORT     0x81
 #define NET_LIGHTSTATUSREPORT 0x82
 #define NET_TIMEREPORT        0x84
@@ -42,6 +49,12 @@ with this program; if not, see <http://www.gnu.org/licenses/>.
 #define NET_LIGHTDBREPORT     0x86
 #define NET_NETHISTREPORT     0x87
 #define NET_SHUTSTATUSREPORT  0x88
+#define NET_REPLY             0x8B
+#define NET_LIGHTBULKREPORT   0x8C
+#define NET_SHUTBULKREPORT    0x8E
+#define NET_SYNCREPORT        0x90
+#define NET_LIGHTDBPART       0x96
+#define NET_SHUTTERDBPART     0x95
 #define NET_RAWSEND           0x70
 #define NET_RAWRECEIVED       0xF0
 #define NET_ERRORREPORT       0xFF
@@ -50,6 +63,37 @@ with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #define NET_ERR_SERVERFULL    0x01
 #define NET_ERR_ILLTYPE       0x02
+#define NET_ERR_ILLDATA       0x03
+#define NET_ERR_BUSY          0x04
+
+/* Bulk packets carry a list of entries: GET requests (module, output)
+   pairs, SET requests and reports (module, output, value) triples, shutter
+   SET requests (module, shutter, min, max) quadruples. An empty bulk GET
+   requests all configured lights or shutters. */
+
+/* NET_REQUEST carries a 2 byte request ID followed by type and payload of
+   the actual request. All packets sent in response are wrapped into
+   NET_REPLY packets with the same layout and request ID, so a client can
+   keep several requests in flight and match replies in any order. */
+
+/*!\brief length of the NET_REQUEST/NET_REPLY header in front of the wrapped packet */
+#define NET_REQ_HDR   3
+
+/*!\brief max. number of entries in one bulk report (larger ones are split) */
+#define NET_BULK_MAX  ((0xFFFF - NET_REQ_HDR) / 3)
+
+/* event classes a client can subscribe to (NET_SUBSCRIBE) */
+
+#define NET_SUB_LIGHT         0x01 /* light status reports */
+#define NET_SUB_SHUTTER       0x02 /* shutter status reports */
+#define NET_SUB_RAW           0x04 /* raw LCN telegrams (NET_RAWRECEIVED) */
+#define NET_SUB_ALL           0x07
+#define NET_SUB_DEFAULT       0x03 /* classes of a client that did not subscribe */
+
+/* filter entries in NET_SUBSCRIBE packets (following the class mask) */
+
+#define NET_SUB_MODULES       'M'  /* first module, last module, output mask */
+#define NET_SUB_TAG           'T'  /* zero terminated name of configured tag */
 
 /*!\brief structure used for maintaining light status (linked list element) */
 struct lights_s
@@ -60,8 +104,10 @@ struct lights_s
 
   signed char state;      /*!<\brief current state of the light 0(off)..100(on) */
   unsigned long time;     /*!<\brief time the state was updated */
+  int dbState;            /*!<\brief position of state in cached data base report */
 
   struct lights_s *next;  /*!<\brief pointer to next element in linked list */
+  struct lights_s *slotNext; /*!<\brief next light on the same module and output */
 };
 
 /*!\brief structure defining a yali packet */
@@ -72,37 +118,146 @@ struct pak_s
   unsigned char *data;    /*!<\brief pointer to packet payload */
 };
 
-/*!\brief maximum number of client that are allowed at a time */
-#define CLI_NUM  4
+/* overflow policies (what happens if the output queue of a client is full) */
+
+#define NET_OVF_DISCONNECT    0 /* close the connection */
+#define NET_OVF_DROPOLDEST    1 /* drop the oldest queued packet */
+#define NET_OVF_COALESCE      2 /* replace queued report for same light/shutter */
+
+/*!\brief key used to coalesce status reports of the same light or shutter */
+#define NET_KEY(type, module, output) (((type) << 16) | ((module) << 8) | (output))
+
+/*!\brief encoded packet, shared by the output queues of all receiving clients */
+struct netBuf_s
+{
+  int ref;                /*!<\brief number of references to this buffer */
+  int len;                /*!<\brief total length of packet */
+  double time;            /*!<\brief time of broadcast (0 if not broadcast) */
+  unsigned char *data;    /*!<\brief packet including 3 byte header */
+};
+
+/*!\brief max. payload of one chunk of a data base report */
+#define NET_DB_CHUNK  4096
+
+/*!\brief data base report, cached as list of encoded chunks
+ *
+ * All chunks but the last are sent with the ...DBPART type, the last one
+ * with the ...DBREPORT type, so a client knows when the report is complete.
+ * Only configuration changes invalidate the cache, state bytes are
+ * patched before the report is sent. A chunk that is still queued for a
+ * client is copied before it is patched, queued chunks never change.
+ */
+struct netDbCache_s
+{
+  int valid;               /*!<\brief 1 if chunks reflect the current data base */
+  int num;                 /*!<\brief number of chunks */
+  int max;                 /*!<\brief number of allocated elements in chunk */
+  struct netBuf_s **chunk; /*!<\brief encoded chunks */
+  int fill;                /*!<\brief bytes used in last chunk (while building) */
+};
+
+/*!\brief structure describing a packet in the output queue of a client */
+struct netOut_s
+{
+  struct netBuf_s *buf;   /*!<\brief encoded packet */
+  int key;                /*!<\brief coalescing key (0 = not coalescable) */
+};
+
+/*!\brief max. number of queued packets handed to the kernel in one call */
+#define NET_IOV_MAX   16
+
+/*!\brief initial size of the receive buffer of a client */
+#define NET_RCBUF_SIZE  512
+
+/*!\brief max. size of the receive buffer of a client (largest packet) */
+#define NET_RCBUF_MAX   (0xFFFF + 3)
+
+/*!\brief time accepting is paused if the server runs out of file descriptors (s) */
+#define NET_ACCEPT_PAUSE  1.0
+
+/*!\brief number of client structures allocated at once when the client table grows */
+#define NET_CLI_SLAB  16
 
 /*!\brief structure used to store yali client information */
 struct netClientDat_s
 {
-  unsigned char rcbuf[128]; /*!<\brief receive buffer for incoming socket data */
-  int rcpos;                /*!<\brief number of bytes in receive buffer */
-  int dummy;                /*!<\brief number of dummy bytes received */
-  int sf;                   /*!<\brief client socket */
+  unsigned char *rcbuf;     /*!<\brief receive buffer for incoming socket data */
+  int rcsize;               /*!<\brief size of receive buffer */
+  int rcstart;              /*!<\brief index of first unprocessed byte in rcbuf */
+  int rcpos;                /*!<\brief index behind last received byte in rcbuf */
+  int sf;                   /*!<\brief client socket (-1 if unused) */
+  int id;                   /*!<\brief client number (used in messages only) */
+  int closing;              /*!<\brief 1 if connection is to be terminated */
+  int reqId;                /*!<\brief ID of request being processed (-1 = none) */
   struct sockaddr_in sa;    /*!<\brief client IP address information */
+  struct netOut_s *outq;    /*!<\brief ring of packets waiting to be sent */
+  int outMax;               /*!<\brief capacity of outq */
+  int outHead;              /*!<\brief index of first packet in outq */
+  int outNum;               /*!<\brief number of packets in outq */
+  int outOff;               /*!<\brief bytes of first packet already sent */
+  int outDrops;             /*!<\brief number of packets dropped due to overflow */
+  unsigned char subClass;   /*!<\brief NET_SUB_xxx: subscribed event classes */
+  unsigned char subOut[256]; /*!<\brief subscribed outputs per module (bit n = output n+1) */
+  struct netClientDat_s *prev; /*!<\brief previous client in list of active clients */
+  struct netClientDat_s *next; /*!<\brief next client in list of active (or free) clients */
 };
 
-/*!\brief array of client connections */
-extern struct netClientDat_s _cli[CLI_NUM];
+/*!\brief check if client is subscribed to events of given class and module/output (0 = any) */
+#define NET_CLI_WANTS(cp, cls, module, output) \
+  (((cp)->subClass & (cls)) && ((output) == 0 ? (cp)->subOut[(module) & 0xFF] != 0 \
+				: ((cp)->subOut[(module) & 0xFF] & (1 << (((output) - 1) & 7)))))
+
+/*!\brief list of active client connections */
+extern struct netClientDat_s *_netCliList;
+
+/*!\brief number of active client connections */
+extern int _netCliNum;
+
+/*!\brief cached light data base report */
+extern struct netDbCache_s _netLightDb;
 
 /*!\brief file descriptor of serial interface (LCN-PK connection) */
 extern int _lcnSerFd;
 
+/*!\brief broadcast packets sent to clients, sum and max. of their delay */
+extern unsigned long _netFanNum;
+extern double _netFanSum;
+extern double _netFanMax;
+
 extern void netPakPrint(struct pak_s *p);
+extern void netPakFree(struct pak_s *p);
 extern void netPakSend(int inSock, struct pak_s *p);
-extern void netTimeSend(int inSock);
-extern void netVersionSend(int inSock);
-extern void netErrorSend(int inSock, int code, char *text);
-extern void netLightStatusSend(int inSock, int module, int output, int value);
-extern void netLightDbSend(int inSock);
-extern void netSockProc(struct pak_s *p, int inSock);
-extern void netSockTerm(int inN);
-extern void netSockDataGet(int inN);
+extern struct netBuf_s *netBufAlloc(int len);
+extern struct netBuf_s *netBufNew(struct pak_s *p, int reqId);
+extern void netBufUnref(struct netBuf_s *b);
+extern int netBufQueue(struct netClientDat_s *cp, struct netBuf_s *b, int key);
+extern int netPakQueue(struct netClientDat_s *cp, struct pak_s *p, int key);
+extern void netPakBroadcast(struct pak_s *p, int key, int cls, int module, int output);
+extern void netCliFlush(struct netClientDat_s *cp);
+extern void netCliClose(struct netClientDat_s *cp);
+extern void netTimeSend(struct netClientDat_s *cp);
+extern void netVersionSend(struct netClientDat_s *cp);
+extern void netErrorSend(struct netClientDat_s *cp, int code, char *text);
+extern void netLightStatusSend(struct netClientDat_s *cp, int module, int output, int value);
+extern void netLightDbSend(struct netClientDat_s *cp);
+extern void netDbCacheClear(struct netDbCache_s *c);
+extern int netDbCacheAdd(struct netDbCache_s *c, int partType, unsigned char *data, int len);
+extern int netDbCacheLast(struct netDbCache_s *c, int len);
+extern int netDbCacheSet(struct netDbCache_s *c, int pos, unsigned char val);
+extern void netDbCacheEnd(struct netDbCache_s *c, int partType, int type);
+extern void netDbCacheSend(struct netClientDat_s *cp, struct netDbCache_s *c);
+extern int netLightSet(int module, int output, int value);
+extern void netLightBulkSend(struct netClientDat_s *cp, struct pak_s *p);
+extern void netShutBulkSend(struct netClientDat_s *cp, struct pak_s *p);
+extern void netSubscribe(struct netClientDat_s *cp, struct pak_s *p);
+extern void netSockProc(struct pak_s *p, struct netClientDat_s *cp);
+extern void netSockTerm(struct netClientDat_s *cp);
+extern void netSockDataGet(struct netClientDat_s *cp);
 extern void netClientAccept(int srvSock);
 extern int netServerOpen();
-extern void netShutStatusSend(int inSock, int module, int output, int value);
+extern void netShutStatusSend(struct netClientDat_s *cp, int module, int output, int value);
+extern void netLightStatusBroadcast(int module, int output, int value);
+extern void netShutStatusBroadcast(int module, int output, int value);
+extern void netRawBroadcast(unsigned char *p, int inLen);
 
 #endif
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+##############################################################################
+# YALI - Yet Another LCN Interface
+#
+# Copyright (C) 2009 Daniel Dallmann
+#
+# This program is free software; you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, see <http://www.gnu.org/licenses/>.
+##############################################################################
+#
+# pchkStub - minimal LCN-PCHK for testing yaliServ -P without a bus
+#
+# Talks the parts of the PCK text protocol yaliServ uses: login, output
+# commands (A<n>DI), status requests (SMA<n>) and acks (>M...!). Output
+# values are kept per module, status messages report them back.
+#
+#   ./pchkStub.py [-p port] [-u user] [-w password] [-d n] [-n module]
+#
+#   -d n       close the connection after n commands (tests the reconnect)
+#   -n module  never ack or answer commands to the module (may be repeated)
+#
+##############################################################################
+
+import argparse
+import re
+import socket
+
+CMD = re.compile(r'>M(\d{3})(\d{3})([.!])(.*)')
+
+
+def serve(conn, args, outputs):
+    f = conn.makefile('rb')
+
+    def send(line):
+        conn.sendall((line + '\r\n').encode())
+
+    def readline():
+        line = f.readline()
+        if not line:
+            return None
+        return line.decode(errors='replace').strip()
+
+    send('LCN-PCK/IP 1.0')
+    send('Username:')
+    user = readline()
+    send('Password:')
+    password = readline()
+    if user != args.user or password != args.password:
+        print('login failed (%s)' % user)
+        send('Authentification failed.')
+        return
+    send('OK')
+    print('logged in (%s)' % user)
+
+    count = 0
+    while True:
+        line = readline()
+        if line is None:
+            print('connection closed by client')
+            return
+        print('<<< ' + line)
+
+        m = CMD.match(line)
+        if not m:
+            continue
+        seg, mod, ack, cmd = m.groups()
+
+        count += 1
+        if args.drop and count >= args.drop:
+            print('dropping connection after %d commands' % count)
+            return
+
+        if int(mod) in args.mute:
+            continue
+
+        if ack == '!':
+            send('-M%s%s!' % (seg, mod))
+
+        a = re.match(r'A(\d)DI(\d{3})(\d{3})', cmd)
+        if a:
+            outputs[(mod, a.group(1))] = int(a.group(2))
+            send(':M%s%sA%s%s' % (seg, mod, a.group(1), a.group(2)))
+
+        s = re.match(r'SMA(\d)', cmd)
+        if s:
+            send(':M%s%sA%s%03d' % (seg, mod, s.group(1),
+                                    outputs.get((mod, s.group(1)), 0)))
+
+
+def main():
+    p = argparse.ArgumentParser(description='minimal LCN-PCHK for testing')
+    p.add_argument('-p', '--port', type=int, default=4114)
+    p.add_argument('-u', '--user', default='lcn')
+    p.add_argument('-w', '--password', default='lcn')
+    p.add_argument('-d', '--drop', type=int, default=0)
+    p.add_argument('-n', '--mute', type=int, action='append', default=[])
+    args = p.parse_args()
+
+    ls = socket.socket()
+    ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    ls.bind(('127.0.0.1', args.port))
+    ls.listen(1)
+    print('LCN-PCHK stub listening on port %d' % args.port)
+
+    outputs = {}
+    while True:
+        conn, addr = ls.accept()
+        print('connection from %s:%d' % addr)
+        try:
+            serve(conn, args, outputs)
+        except OSError as e:
+            print('connection error: %s' % e)
+        conn.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -23,6 +23,7 @@ with this program; if not, see <http://www.gnu.org/licenses/>.
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
 #include "yali.h"
 
@@ -35,11 +36,17 @@ int _stateHistBufPtr = 0;
 
 /*!\brief initialize history buffer
  * \return N/A
+ *
+ * A new epoch is chosen, so sequence numbers of an earlier run of the
+ * server are not mistaken for the current ones.
  */
 void stateBufInit(void)
 {
   int i;
 
+  _stateEpoch = ((unsigned long) time(NULL) ^ ((unsigned long) getpid() << 16)) & 0xFFFFFFFF;
+  if (_stateEpoch == 0) _stateEpoch = 1;
+
   _stateHistBuf = (unsigned char*) malloc(STATE_BUF_SIZE);
   if (_stateHistBuf==NULL)
     {
@@ -55,13 +62,24 @@ void stateBufInit(void)
 }
 
 
-/*!\brief log stats change of a light into history buffer
- * \param module ID of LCN module the light is connected to
- * \param output output of LCN module the light is connected to
- * \param value new state of the light (0=off ... 100=on)
+/*!\brief sequence number of the last change logged into history buffer */
+unsigned long _stateSeq = 0;
+
+/*!\brief identifies this run of the server in NET_SYNCREPORT (never 0) */
+unsigned long _stateEpoch = 0;
+
+/*!\brief cached shutter data base report */
+struct netDbCache_s _stateShutDb;
+
+
+/*!\brief log stats change into history buffer
+ * \param kind 1=light, 2=shutter
+ * \param module ID of LCN module the light/shutter is connected to
+ * \param output output/shutter of LCN module
+ * \param value new state (0=off/closed ... 100=on/open)
  * \return N/A
  */
-void stateLightLog(int module, int output, int value)
+void stateLog(int kind, int module, int output, int value)
 {
   unsigned char *p;
   unsigned long tm;
@@ -75,12 +93,25 @@ void stateLightLog(int module, int output, int value)
   p[1] = (tm >> 16) & 0xFF;
   p[2] = (tm >> 8) & 0xFF;
   p[3] = tm & 0xFF;
-  p[4] = 1;
+  p[4] = kind;
   p[5] = module;
   p[6] = output;
   p[7] = value;
 
   _stateHistBufPtr = (_stateHistBufPtr + 8) % STATE_BUF_SIZE;
+  _stateSeq++;
+}
+
+
+/*!\brief log stats change of a light into history buffer
+ * \param module ID of LCN module the light is connected to
+ * \param output output of LCN module the light is connected to
+ * \param value new state of the light (0=off ... 100=on)
+ * \return N/A
+ */
+void stateLightLog(int module, int output, int value)
+{
+  stateLog(1, module, output, value);
 }
 
 
@@ -92,24 +123,104 @@ void stateLightLog(int module, int output, int value)
  */
 void stateShutLog(int module, int shutter, int value)
 {
-  unsigned char *p;
-  unsigned long tm;
+  stateLog(2, module, shutter, value);
+}
 
-  yaliTimeAdapt();
-  tm = _yaliTime;
 
-  p = &_stateHistBuf[_stateHistBufPtr];
+/*!\brief create yali packet with all changes since given sequence number
+ * \param inEpoch epoch of the server the client has synced with (0 if none)
+ * \param inSeq sequence number the client has already seen
+ * \return pointer to packet definition structure (NULL if out of memory)
+ *
+ * The payload starts with the epoch (4 bytes), the current sequence
+ * number (4 bytes) and a mode byte. If inEpoch is the current epoch and
+ * all changes after inSeq are still in the history buffer, mode is
+ * STATE_SYNC_DELTA and the changes follow in the format of the history
+ * report. Otherwise mode is STATE_SYNC_SNAPSHOT and the current state of
+ * all lights and shutters follows as (kind, module, output, value)
+ * entries.
+ */
+struct pak_s *stateSyncGet(unsigned long inEpoch, unsigned long inSeq)
+{
+  struct pak_s *p;
+  struct lights_s *lp;
+  struct shutter_s *sp;
+  unsigned long kept;
+  unsigned long num;
+  unsigned char *d;
+  int len;
+  int idx;
+  int i;
 
-  p[0] = (tm >> 24) & 0xFF;
-  p[1] = (tm >> 16) & 0xFF;
-  p[2] = (tm >> 8) & 0xFF;
-  p[3] = tm & 0xFF;
-  p[4] = 2;
-  p[5] = module;
-  p[6] = shutter;
-  p[7] = value;
+  p = (struct pak_s*) malloc(sizeof(struct pak_s));
+  if (p == NULL)
+    {
+      fprintf(stderr, "out of memory");
+      return NULL;
+    }
 
-  _stateHistBufPtr = (_stateHistBufPtr + 8) % STATE_BUF_SIZE;
+  p->type = NET_SYNCREPORT;
+  p->data = (unsigned char*) malloc(0xFFFF);
+  if (p->data == NULL)
+    {
+      fprintf(stderr, "out of memory");
+      free(p);
+      return NULL;
+    }
+
+  d = p->data;
+  d[0] = (_stateEpoch >> 24) & 0xFF;
+  d[1] = (_stateEpoch >> 16) & 0xFF;
+  d[2] = (_stateEpoch >> 8) & 0xFF;
+  d[3] = _stateEpoch & 0xFF;
+  d[4] = (_stateSeq >> 24) & 0xFF;
+  d[5] = (_stateSeq >> 16) & 0xFF;
+  d[6] = (_stateSeq >> 8) & 0xFF;
+  d[7] = _stateSeq & 0xFF;
+  len = 9;
+
+  kept = _stateSeq;
+  if (kept > STATE_BUF_SIZE/8) kept = STATE_BUF_SIZE/8;
+
+  if (inEpoch == _stateEpoch && inSeq <= _stateSeq && _stateSeq - inSeq <= kept)
+    {
+      d[8] = STATE_SYNC_DELTA;
+
+      num = _stateSeq - inSeq;
+      idx = (_stateHistBufPtr + STATE_BUF_SIZE - 8*num) % STATE_BUF_SIZE;
+
+      for (i=0; i<8*num; i++)
+	{
+	  d[len++] = _stateHistBuf[idx];
+	  idx = (idx + 1) % STATE_BUF_SIZE;
+	}
+    }
+  else
+    {
+      d[8] = STATE_SYNC_SNAPSHOT;
+
+      for (lp = _lights; lp != NULL && len+4 <= 0xFFFF; lp = lp->next)
+	{
+	  d[len]   = 1;
+	  d[len+1] = lp->module;
+	  d[len+2] = lp->output;
+	  d[len+3] = lp->state;
+	  len += 4;
+	}
+
+      for (sp = _stateShutRoot; sp != NULL && len+4 <= 0xFFFF; sp = sp->next)
+	{
+	  d[len]   = 2;
+	  d[len+1] = sp->module;
+	  d[len+2] = sp->rnum;
+	  d[len+3] = floor(0.5 + 50.0*(sp->posMin + sp->posMax));
+	  len += 4;
+	}
+    }
+
+  p->len = len;
+
+  return p;
 }
 
 
@@ -179,39 +290,31 @@ struct pak_s *stateLightHistGet(void)
 void stateLightUpdate(int module, int output, int value)
 {
   struct lights_s *lp;
-  int i;
+  struct lights_s *first;
+  int changed;
+
+  first = confLightFind(module, output);
+  if (first == NULL) return;
 
-  lp = _lights;
-  while (lp != 0)
+  changed = (first->state != value);
+
+  /* all lights configured on the output */
+  for (lp = first; lp != NULL; lp = lp->slotNext)
     {
-      if (lp->module == module)
+      if (_conf.showLcnTraffic)
 	{
-	  if (lp->output==output)
-	    {
-	      if (_conf.showLcnTraffic)
-		{
-		  printf("LCN: \"%s\" auf %i%%%s\n", lp->name, value,
-			 (lp->state!=value)?" (changed)":"" );
-		}
-
-	      lp->time  = _yaliTime;
-
-	      if (lp->state != value)
-		{
-		  stateLightLog(module, output, value);
-		  lp->state = value;
-
-		  for (i=0; i<CLI_NUM; i++)
-		    {
-		      if (_cli[i].sf != -1)
-			{
-			  netLightStatusSend(_cli[i].sf, module, output, value);
-			}
-		    }
-		}
-	    }
+	  printf("LCN: \"%s\" auf %i%%%s\n", lp->name, value,
+		 (lp->state!=value)?" (changed)":"" );
 	}
-      lp = lp->next;
+
+      lp->time  = _yaliTime;
+      lp->state = value;
+    }
+
+  if (changed)
+    {
+      stateLightLog(module, output, value);
+      netLightStatusBroadcast(module, output, value);
     }
 }
 
@@ -225,7 +328,6 @@ void stateShutUpdate2(struct shutter_s *p, int inDirection)
   double diffMax;
   double posMin;
   double posMax;
-  int i;
 
   time = 0.1 * _tick; /*getCurrentTime();*/
 
@@ -268,14 +370,8 @@ void stateShutUpdate2(struct shutter_s *p, int inDirection)
 
   if (p->move != 0)
     {
-      for (i=0; i<CLI_NUM; i++)
-	{
-	  if (_cli[i].sf != -1)
-	    {
-	      netShutStatusSend(_cli[i].sf, p->module, p->rnum,
-				   floor(0.5 + 50.0*(p->posMin + p->posMax)) );
-	    }
-	}
+      netShutStatusBroadcast(p->module, p->rnum,
+			     floor(0.5 + 50.0*(p->posMin + p->posMax)) );
 
 #ifdef DBG
       printf(" (%1.2fs/%1.2fs %s)", 0.5*(diffMin + diffMax),
@@ -300,15 +396,11 @@ void stateShutUpdate(int inModule, int inShutNum, int inDirection)
 {
   struct shutter_s *p;
 
-  p = _stateShutRoot;
-  while (p != NULL)
+  p = stateShutPtrGet(inModule, inShutNum);
+  if (p != NULL)
     {
-      if ( (p->module == inModule) && (p->rnum == inShutNum) )
-	{
-	  stateShutUpdate2(p, inDirection);
-	  return;
-	} 
-      p = p->next;
+      stateShutUpdate2(p, inDirection);
+      return;
     }
 
   /* unkown - ignore */
@@ -338,50 +430,74 @@ void stateShutCreate(int inModule, int inShut, char *inName, double inTUp, doubl
   p->posMin = 0.0; /* unknown */
   p->posMax = 1.0; /* unknown */
   p->move = 0; /* doesn't move */
+  p->dbPos = -1;
   p->time = 0.0;
   p->next = _stateShutRoot;
 
   _stateShutRoot = p;
+  confShutReg(p);
+
+  netDbCacheClear(&_stateShutDb);
 }
 
-/*!\brief send packet containing shutter data base to socket connection
- * \param inSock socket to send to
+/*!\brief send packet(s) containing shutter data base to client connection
+ * \param cp client to send to
  * \return N/A
+ *
+ * The report is built once and kept until a shutter is added, the
+ * current positions are written into it before it is sent.
  */
-void stateShutDbSend(int inSock)
+void stateShutDbSend(struct netClientDat_s *cp)
 {
-  int len;
   int y;
-  struct pak_s pak;
+  unsigned char buf[NET_DB_CHUNK];
   struct shutter_s *sp;
 
-  len = 0;
-
-  sp = _stateShutRoot;
-  while (sp)
+  if (!_stateShutDb.valid)
     {
-      _yaliBuf[len] = sp->module;
-      _yaliBuf[len+1] = sp->rnum;
-      _yaliBuf[len+2] = floor(0.5 + (100.0 * sp->posMin));
-      _yaliBuf[len+3] = floor(0.5 + (100.0 * sp->posMax));
+      netDbCacheClear(&_stateShutDb);
 
-      y = 0;
-      while (sp->name[y] != 0)
+      for (sp = _stateShutRoot; sp != NULL; sp = sp->next)
 	{
-	  _yaliBuf[len+4+y] = sp->name[y];
-	  y++;
+	  buf[0] = sp->module;
+	  buf[1] = sp->rnum;
+	  buf[2] = floor(0.5 + (100.0 * sp->posMin));
+	  buf[3] = floor(0.5 + (100.0 * sp->posMax));
+
+	  y = 0;
+	  while (sp->name[y] != 0 && y < NET_DB_CHUNK-5)
+	    {
+	      buf[4+y] = sp->name[y];
+	      y++;
+	    }
+	  buf[4+y] = 0;
+
+	  if (netDbCacheAdd(&_stateShutDb, NET_SHUTTERDBPART, buf, 5+y) != 0)
+	    {
+	      fprintf(stderr, "out of memory building shutter data base\n");
+	      netDbCacheClear(&_stateShutDb);
+	      return;
+	    }
+	  sp->dbPos = netDbCacheLast(&_stateShutDb, 5+y) + 2;
 	}
-      _yaliBuf[len+4+y] = 0;
-      len += 5+y;
 
-      sp = sp->next;
+      netDbCacheEnd(&_stateShutDb, NET_SHUTTERDBPART, NET_SHUTTERDBREPORT);
+    }
+  else
+    {
+      for (sp = _stateShutRoot; sp != NULL; sp = sp->next)
+	{
+	  if (netDbCacheSet(&_stateShutDb, sp->dbPos, floor(0.5 + (100.0 * sp->posMin))) != 0 ||
+	      netDbCacheSet(&_stateShutDb, sp->dbPos + 1, floor(0.5 + (100.0 * sp->posMax))) != 0)
+	    {
+	      fprintf(stderr, "out of memory updating shutter data base\n");
+	      netDbCacheClear(&_stateShutDb);
+	      return;
+	    }
+	}
     }
 
-  pak.type = NET_SHUTTERDBREPORT;
-  pak.len = len;
-  pak.data = _yaliBuf;
-
-  netPakSend(inSock, &pak);
+  netDbCacheSend(cp, &_stateShutDb);
 }
 
 void stateShutCheck(void)
@@ -394,7 +510,6 @@ void stateShutCheck(void)
   double posMin;
   double posMax;
   int flag;
-  int i;
 
   time = 0.1 * _tick; /*getCurrentTime();*/
 
@@ -442,14 +557,8 @@ void stateShutCheck(void)
 
 	  stateShutLog(p->module, p->rnum, floor(0.5 + 50.0*(p->posMin + p->posMax)) );
 
-	  for (i=0; i<CLI_NUM; i++)
-	    {
-	      if (_cli[i].sf != -1)
-		{
-		  netShutStatusSend(_cli[i].sf, p->module, p->rnum,
-				       floor(0.5 + 50.0*(p->posMin + p->posMax)) );
-		}
-	    }
+	  netShutStatusBroadcast(p->module, p->rnum,
+				 floor(0.5 + 50.0*(p->posMin + p->posMax)) );
 
 #ifdef DBG
 	  printf("M%02i/%i is now at %1.1f%% (endstop)\n", p->module, p->rnum,
@@ -463,20 +572,12 @@ void stateShutCheck(void)
 
 struct shutter_s *stateShutPtrGet(int inModule, int inShut)
 {
-  struct shutter_s *p;
-  
-  p = _stateShutRoot;
-  while (p != NULL)
+  if (inModule < 0 || inModule > 255 || inShut < 1 || inShut > CONF_MOD_SLOTS)
     {
-      if ( (p->module == inModule) && (p->rnum == inShut) )
-	{
-	  return p;
-	}
-      
-      p = p->next;
+      return NULL;
     }
-  
-  return NULL;
+
+  return _confModules[inModule].shut[inShut-1];
 }
 
 int stateShutGet(int inModule, int inShut)
@@ -536,14 +637,8 @@ void stateShutAdapt(struct shutter_s *sp, float inPos)
   if (sp->posMin > 1.0) sp->posMin = 1.0;
   if (sp->posMax > 1.0) sp->posMax = 1.0;
 
-  for (i=0; i<CLI_NUM; i++)
-    {
-      if (_cli[i].sf != -1)
-	{
-	  netShutStatusSend(_cli[i].sf, sp->module, sp->rnum,
-			       floor(0.5 + 50.0*(sp->posMin + sp->posMax)) );
-	}
-    }
+  netShutStatusBroadcast(sp->module, sp->rnum,
+			 floor(0.5 + 50.0*(sp->posMin + sp->posMax)) );
 
 #ifdef DBG
   printf("shutter move time %1.2fs\n", tm);
@@ -575,22 +670,18 @@ void stateShutCommand(int inModule, int inShutNum, int inMin, int inMax)
 
   assert(inMin <= inMax);
 
-  p = _stateShutRoot;
-  while (p != NULL)
+  p = stateShutPtrGet(inModule, inShutNum);
+  if (p != NULL)
     {
-      if ( (p->module == inModule) && (p->rnum == inShutNum) )
-	{
-	  pos = -1;
-	  if (inMax == 0 || (inMin == 0 && inMax > p->posMax)) pos = 0;
-	  else if (inMin == 100 || (inMax == 100 && inMin < p->posMin)) pos = 100;
-	  else if (inMax < p->posMin || inMin > p->posMax) pos = (inMin + inMax)/2;
-	  else if (inMin < p->posMin && inMax > p->posMax) return; /* pos is ok */
-	  else pos = (inMin + inMax)/2;
-
-	  stateShutAdapt(p, 0.01 * pos);
-	  return;
-	} 
-      p = p->next;
+      pos = -1;
+      if (inMax == 0 || (inMin == 0 && inMax > p->posMax)) pos = 0;
+      else if (inMin == 100 || (inMax == 100 && inMin < p->posMin)) pos = 100;
+      else if (inMax < p->posMin || inMin > p->posMax) pos = (inMin + inMax)/2;
+      else if (inMin < p->posMin && inMax > p->posMax) return; /* pos is ok */
+      else pos = (inMin + inMax)/2;
+
+      stateShutAdapt(p, 0.01 * pos);
+      return;
     }
 
   /* unkown - ignore */
@@ -30,6 +30,22 @@ extern void stateShutCheck(void);
 /*!\brief size of the history buffer */
 #define STATE_BUF_SIZE (8*512)
 
+/* modes of NET_SYNCREPORT packets */
+
+#define STATE_SYNC_DELTA     0 /* changes since requested sequence number */
+#define STATE_SYNC_SNAPSHOT  1 /* current state of all lights and shutters */
+
+/*!\brief sequence number of the last change logged into history buffer */
+extern unsigned long _stateSeq;
+
+/*!\brief identifies this run of the server in NET_SYNCREPORT (never 0) */
+extern unsigned long _stateEpoch;
+
+/*!\brief cached shutter data base report */
+extern struct netDbCache_s _stateShutDb;
+
+extern struct pak_s *stateSyncGet(unsigned long inEpoch, unsigned long inSeq);
+
 /*!\brief pointer to state history buffer */
 extern unsigned char *_stateHistBuf;
 
@@ -44,6 +60,7 @@ struct shutter_s
   float posMax;
   double time;
   int move;
+  int dbPos;             /* position of min./max. in the cached data base report */
   struct shutter_s *next;
 };
 
@@ -53,7 +70,7 @@ extern void stateShutUpdate(int inModule, int inShutNum, int inDirection);
 extern int stateShutGet(int inModule, int inShut);
 extern void stateShutCreate(int inModule, int inShut, char *inName, double inTUp, double inTDown);
 extern struct shutter_s *stateShutPtrGet(int inModule, int inShut);
-extern void stateShutDbSend(int inSock);
+extern void stateShutDbSend(struct netClientDat_s *cp);
 extern void stateShutAdapt(struct shutter_s *sp, float inPos);
 extern void stateShutCommand(int inModule, int inShutNum, int inMin, int inMax);
 
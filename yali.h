@@ -30,8 +30,12 @@ typedef int socklen_t;
 #include "conf.h"
 #include "net_io.h"
 #include "lcn_io.h"
+#include "lcn_pchk.h"
+#include "lcn_log.h"
 #include "state.h"
 #include "time_queue.h"
+#include "event_loop.h"
+#include "lcn_replay.h"
 #include "netinet/in.h"
 
 extern unsigned long _yaliTime;
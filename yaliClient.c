@@ -258,14 +258,27 @@ void yaliListAllActiveLights(int inNum)
 void yaliLightStatPrint(char **cp, int n)
 {
   int i;
+  int id;
+  int pending;
+  struct lights_s **lpa;
   struct lights_s *lp;
   struct pak_s pk;
   struct pak_s *p;
   unsigned char buf[8];
-  signed char val;
+  signed char *val;
+
+  lpa = (struct lights_s**) calloc(n, sizeof(struct lights_s*));
+  val = (signed char*) malloc(n);
+  if (lpa == NULL || val == NULL)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
 
   pk.data = buf;
+  pending = 0;
 
+  /* send all requests at once, replies are matched by request ID */
   for (i=0; i<n; i++)
     {
       lp = _lights;
@@ -278,41 +291,73 @@ void yaliLightStatPrint(char **cp, int n)
 	  lp = lp->next;
 	}
 
-      pk.type = NET_LIGHTSTATUSGET;
-      pk.len = 2;
-      pk.data[0] = lp->module;
-      pk.data[1] = lp->output;
+      lpa[i] = lp;
+      if (lp == NULL)
+	{
+	  fprintf(stderr, "unknown light \"%s\"\n", cp[i]);
+	  continue;
+	}
+
+      pk.type = NET_REQUEST;
+      pk.len = NET_REQ_HDR + 2;
+      pk.data[0] = i >> 8;
+      pk.data[1] = i & 0xFF;
+      pk.data[2] = NET_LIGHTSTATUSGET;
+      pk.data[3] = lp->module;
+      pk.data[4] = lp->output;
       
       netPakSend(_serverSock, &pk);
+      pending++;
       
       if (_beVerbose)
 	{
 	  printf(">>> ");
 	  netPakPrint(&pk);
 	}
-      
-      do {
-	p = pakReceive(_serverSock);
+    }
+
+  while (pending > 0)
+    {
+      p = pakReceive(_serverSock);
+      if (p == NULL) exit(1);
 	
-	if (_beVerbose)
-	  {
-	    printf("<<< ");
-	    netPakPrint(p);
-	  }
-      } while (p->type != NET_LIGHTSTATUSREPORT
-	       || p->data[0] != lp->module
-	       || p->data[1] != lp->output);
-      
-      val = p->data[2];
-      if (val >= 0)
+      if (_beVerbose)
 	{
-	  printf("Light \"%s\" = %i %%\n", lp->name, val);
+	  printf("<<< ");
+	  netPakPrint(p);
+	}
+
+      if (p->type == NET_REPLY && p->len >= NET_REQ_HDR + 3
+	  && p->data[2] == NET_LIGHTSTATUSREPORT)
+	{
+	  id = (p->data[0] << 8) | p->data[1];
+	  if (id < n && lpa[id] != NULL)
+	    {
+	      val[id] = p->data[NET_REQ_HDR + 2];
+	      pending--;
+	    }
+	}
+
+      netPakFree(p);
+    }
+
+  for (i=0; i<n; i++)
+    {
+      lp = lpa[i];
+      if (lp == NULL) continue;
+
+      if (val[i] >= 0)
+	{
+	  printf("Light \"%s\" = %i %%\n", lp->name, val[i]);
 	}
       else
 	{
 	  printf("Light \"%s\" = ? %%\n", lp->name);
 	}
     }
+
+  free(lpa);
+  free(val);
 }
 
 void yaliLightStatSet(char **cp, int n, int val)
@@ -320,9 +365,16 @@ void yaliLightStatSet(char **cp, int n, int val)
   int i;
   struct lights_s *lp;
   struct pak_s pk;
-  unsigned char buf[8];
 
-  pk.data = buf;
+  /* all lights are switched with one bulk packet */
+  pk.type = NET_LIGHTBULKSET;
+  pk.len = 0;
+  pk.data = (unsigned char*) malloc(3*n);
+  if (pk.data == NULL)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
 
   for (i=0; i<n; i++)
     {
@@ -333,24 +385,28 @@ void yaliLightStatSet(char **cp, int n, int val)
 	    {
 	      printf("Switching light \"%s\" to %i %%\n", cp[i], val);
 
-	      pk.type = NET_LIGHTSTATUSSET;
-	      pk.len = 3;
-	      pk.data[0] = lp->module;
-	      pk.data[1] = lp->output;
-	      pk.data[2] = val;
-
-	      netPakSend(_serverSock, &pk);
-
-	      if (_beVerbose)
-		{
-		  printf(">>> ");
-		  netPakPrint(&pk);
-		}
+	      pk.data[pk.len] = lp->module;
+	      pk.data[pk.len+1] = lp->output;
+	      pk.data[pk.len+2] = val;
+	      pk.len += 3;
 	      break;
 	    }
 	  lp = lp->next;
 	}
     }
+
+  if (pk.len > 0)
+    {
+      netPakSend(_serverSock, &pk);
+
+      if (_beVerbose)
+	{
+	  printf(">>> ");
+	  netPakPrint(&pk);
+	}
+    }
+
+  free(pk.data);
 }
 
 void yaliShutList(void)
@@ -601,6 +657,7 @@ int main(int argc, char **argv)
       netPakPrint(&pk);
     }
 
+  y = 0;
   do {
     p = pakReceive(_serverSock);
 
@@ -609,20 +666,22 @@ int main(int argc, char **argv)
 	printf("<<< ");
 	netPakPrint(p);
       }
-  } while (p->type != NET_LIGHTDBREPORT);
 
-  y = 0;
-  i = 0;
-  while (i < p->len)
-    {
-      y++;
+    if (p->type != NET_LIGHTDBPART && p->type != NET_LIGHTDBREPORT) continue;
 
-      confLightAdd(p->data[i], p->data[i+1], p->data[i+2], (char*) &p->data[i+3]);
-      i += 3;
+    /* large data bases are sent in several chunks */
+    i = 0;
+    while (i < p->len)
+      {
+	y++;
 
-      while (i < p->len && p->data[i]) i++;
-      i++;
-    }
+	confLightAdd(p->data[i], p->data[i+1], p->data[i+2], (char*) &p->data[i+3]);
+	i += 3;
+
+	while (i < p->len && p->data[i]) i++;
+	i++;
+      }
+  } while (p->type != NET_LIGHTDBREPORT);
 
   /* obtain database of all shutters from server */
 
@@ -637,6 +696,7 @@ int main(int argc, char **argv)
       netPakPrint(&pk);
     }
   
+  y = 0;
   do {
     p = pakReceive(_serverSock);
     
@@ -645,24 +705,25 @@ int main(int argc, char **argv)
 	printf("<<< ");
 	netPakPrint(p);
       }
-  } while (p->type != NET_SHUTTERDBREPORT);
-  
-  y = 0;
-  i = 0;
-  while (i < p->len)
-    {
-      y++;
+
+    if (p->type != NET_SHUTTERDBPART && p->type != NET_SHUTTERDBREPORT) continue;
+
+    i = 0;
+    while (i < p->len)
+      {
+	y++;
       
-      stateShutCreate(p->data[i], p->data[i+1], (char*) &p->data[i+4], 0.0, 0.0);
+	stateShutCreate(p->data[i], p->data[i+1], (char*) &p->data[i+4], 0.0, 0.0);
 
-      _stateShutRoot->posMin = p->data[i+2];
-      _stateShutRoot->posMax = p->data[i+3];
+	_stateShutRoot->posMin = p->data[i+2];
+	_stateShutRoot->posMax = p->data[i+3];
 
-      i += 4;
+	i += 4;
       
-      while (i < p->len && p->data[i]) i++;
-      i++;
-    }
+	while (i < p->len && p->data[i]) i++;
+	i++;
+      }
+  } while (p->type != NET_SHUTTERDBREPORT);
   
   /* perform actions defined by command line parameters */
   
@@ -39,6 +39,9 @@ char *_yaliVersionText = "Yali Server-C V1.0";
 
 unsigned long _yaliTime = 0;
 
+/*! \brief number of status requests kept in the poll lane (see yaliRefresh) */
+#define YALI_POLL_AHEAD 2
+
 /* obtain current time and write to global variable */
 void yaliTimeAdapt(void)
 {
@@ -52,35 +55,44 @@ void yaliTimeAdapt(void)
 void yaliScheduleRefresh(int inModule)
 {
   struct lights_s *lp;
+  int i;
+
+  if (!CONF_MOD_KNOWN(inModule)) return;
 
-  for (lp = _lights; lp!=NULL; lp=lp->next)
+  for (i=0; i<CONF_MOD_SLOTS; i++)
     {
-      if (lp->module == inModule)
+      for (lp = _confModules[inModule & 0xFF].light[i]; lp != NULL; lp = lp->slotNext)
 	{
 	  lp->time = _yaliTime - 55;
 	}
     }
 }
 
-/* do refresh */
+/* do refresh
+ *
+ * Status requests for modules not heard of for 10 minutes are queued
+ * YALI_POLL_AHEAD at a time, the sender takes them whenever the bus has
+ * room. So after a start all modules are refreshed as fast as the bus
+ * allows, without delaying client commands.
+ */
 void yaliRefresh(void)
 {
   signed long tmp;
   signed long max;
   int module;
   struct lights_s *lp;
-  struct lights_s *lp2;
-  static unsigned long ltime = 0;
 
   yaliTimeAdapt();
 
   /* timed sending */
   {
     struct timeQueue_s *p = _timeQueue;
+    int n = 0;
 
-    if (p != NULL && p->time <= _tick)
+    while (p != NULL && p->time <= _tick)
       {
-	lcnQueueCmdAdd(&p->lcn, 8);
+	/* keep packet in time queue if send queue is full */
+	if (lcnQueueCmdAdd(&p->lcn, 8, LCN_PRIO_TIMED) != 0) return;
 	_timeQueue = p->next;
 
 #ifdef DBG
@@ -89,32 +101,38 @@ void yaliRefresh(void)
 #endif
 
 	free(p);
-	return;
+	p = _timeQueue;
+	n++;
       }
-  }
 
-  if (ltime==_yaliTime) return;
+    if (n > 0) return;
+  }
 
-  module = 1;
-  
-  max = 0;
-  for (lp = _lights; lp!=NULL; lp=lp->next)
+  while (_lcnSendQueue[LCN_PRIO_POLL].num < YALI_POLL_AHEAD)
     {
-      tmp = _yaliTime - (lp->time + 600);
-      if (tmp > max)
+      module = 1;
+
+      max = 0;
+      for (lp = _lights; lp!=NULL; lp=lp->next)
 	{
-	  lp2 = lp;
-	  max = tmp;
-	  module = lp->module;
+	  tmp = _yaliTime - (lp->time + 600);
+	  if (tmp > max)
+	    {
+	      max = tmp;
+	      module = lp->module;
+	    }
 	}
-    }  
 
-  if (max > 0)
-    {
+      if (max <= 0) break;
+
       /* request status for module */
-      lcnQueueCommandSend(_lcnSerFd, module, 0x6E, 0xFB, 0x01);
-      lp2->time = _yaliTime;
-      ltime = _yaliTime;
+      if (lcnQueueCommandSend(_lcnSerFd, module, 0x6E, 0xFB, 0x01, LCN_PRIO_POLL) != 0) return;
+
+      /* one report covers all outputs of the module */
+      for (lp = _lights; lp!=NULL; lp=lp->next)
+	{
+	  if (lp->module == module) lp->time = _yaliTime;
+	}
     }
 }
 
@@ -122,31 +140,60 @@ void handleSigPipe()
 {
 }
 
-void announce()
+/*! \brief SIGTERM/SIGINT: leave the event loop, the log is closed in main
+ *  \param inSig signal number
+ *  \return N/A
+ */
+void handleSigTerm(int inSig)
+{
+  evLoopStop();
+}
+
+/*! \brief periodic work, called every 100 ms by the event loop
+ *  \param inCtx unused
+ *  \return N/A
+ */
+void yaliTick(void *inCtx)
 {
   _tick++;
+
+  if (_conf.lcnInterface && _conf.showLcnTraffic && (_tick % 600) == 0)
+    {
+      if (_lcnTrans == &_lcnTransPchk) lcnPchkStatPrint();
+      else lcnSerStatPrint();
+    }
+
+  if (_conf.lcnInterface)
+    {
+      yaliRefresh();
+    }
+
+  stateShutCheck();
+}
+
+/*! \brief event handler for the LCN interface (serial port or LCN-PCHK)
+ *  \return N/A
+ */
+void yaliSerEvent(int inFd, int inEvents, void *inCtx)
+{
+  _lcnTrans->event(inFd, inEvents);
 }
 
-void timer_start()
+/*! \brief event handler for the listening server socket
+ *  \return N/A
+ */
+void yaliSrvEvent(int inFd, int inEvents, void *inCtx)
 {
-  struct itimerval val;
-
-    signal(SIGALRM,announce);    /* handler for SIGALRM */     
- 
-    /* set the timer for 3 seconds with an interval of 5 seconds
-        on the system clock
-     */
-    val.it_value.tv_sec = 1;                                   
-    val.it_value.tv_usec = 0;
-    val.it_interval.tv_sec = 0; 
-    val.it_interval.tv_usec = 100000;
- 
-    setitimer(ITIMER_REAL,&val,0);    /* start the timer */    
+  netClientAccept(inFd);
 }
 
 void usage(char *appname)
 {
-  printf("%s: [-hv] [-p <port>] [-i <interface>] [-b <binlog_prefix>] [-c <config>]\n", appname);
+  printf("%s: [-hv] [-p <port>] [-i <interface>] [-b <binlog_prefix>] [-c <config>]\n"
+	 "  [-q <queue_len>] [-o disconnect|drop|coalesce]\n"
+	 "  [-r <binlog_prefix>|<raw_file>] [-s <speed> (0 = max.)]\n"
+	 "  [-B <baud>] [-m <vmin> (1..8)] [-l 0|1 (low latency)]\n"
+	 "  [-P <pchk_host>[:<port>]] [-U <pchk_user>] [-W <pchk_password>]\n", appname);
 }
 
 int parse_cmdline(int argc, char **argv)
@@ -188,6 +235,7 @@ int parse_cmdline(int argc, char **argv)
                         {
                             i++;
                             _conf.lcnInterface = argv[i];
+                            _conf.lcnPchk = 0;
                             y = 0;
                             break;
                         }
@@ -208,6 +256,107 @@ int parse_cmdline(int argc, char **argv)
                             break;
                         }
 
+                    case 'q':
+                        {
+                            i++;
+                            _conf.netOutQueueLen = atoi(argv[i]);
+                            if (_conf.netOutQueueLen < 2)
+                            {
+                                printf("%s: queue length must be at least 2\n", argv[0]);
+                                return 1;
+                            }
+                            y = 0;
+                            break;
+                        }
+
+                    case 'o':
+                        {
+                            i++;
+                            if (strcmp(argv[i], "disconnect") == 0)
+                                _conf.netOverflow = NET_OVF_DISCONNECT;
+                            else if (strcmp(argv[i], "drop") == 0)
+                                _conf.netOverflow = NET_OVF_DROPOLDEST;
+                            else if (strcmp(argv[i], "coalesce") == 0)
+                                _conf.netOverflow = NET_OVF_COALESCE;
+                            else
+                            {
+                                printf("%s: unknown overflow policy %s\n", argv[0], argv[i]);
+                                return 1;
+                            }
+                            y = 0;
+                            break;
+                        }
+
+                    case 'r':
+                        {
+                            i++;
+                            _conf.lcnReplayName = argv[i];
+                            y = 0;
+                            break;
+                        }
+
+                    case 's':
+                        {
+                            i++;
+                            _conf.lcnReplaySpeed = atof(argv[i]);
+                            if (_conf.lcnReplaySpeed < 0.0)
+                            {
+                                printf("%s: replay speed must not be negative\n", argv[0]);
+                                return 1;
+                            }
+                            y = 0;
+                            break;
+                        }
+
+                    case 'B':
+                        {
+                            i++;
+                            _conf.lcnBaud = atoi(argv[i]);
+                            y = 0;
+                            break;
+                        }
+
+                    case 'm':
+                        {
+                            i++;
+                            _conf.lcnVmin = atoi(argv[i]);
+                            y = 0;
+                            break;
+                        }
+
+                    case 'l':
+                        {
+                            i++;
+                            _conf.lcnLowLatency = atoi(argv[i]) != 0;
+                            y = 0;
+                            break;
+                        }
+
+                    case 'P':
+                        {
+                            i++;
+                            _conf.lcnInterface = argv[i];
+                            _conf.lcnPchk = 1;
+                            y = 0;
+                            break;
+                        }
+
+                    case 'U':
+                        {
+                            i++;
+                            _conf.lcnPchkUser = argv[i];
+                            y = 0;
+                            break;
+                        }
+
+                    case 'W':
+                        {
+                            i++;
+                            _conf.lcnPchkPass = argv[i];
+                            y = 0;
+                            break;
+                        }
+
                     default:
                         printf("%s: unknown option -%c\n",
                                argv[0], argv[i][y]);
@@ -237,12 +386,11 @@ int parse_cmdline(int argc, char **argv)
 int main(int argc, char **argv)
 {
   int srvSock;
-  int tmp;
+  int lcnFd;
   int i;
-  fd_set readfs;
-  fd_set errorfs;
-  int maxfd;
   char *cp;
+  struct evTimer_s tickTimer;
+  struct lcnReplay_s replay;
 
   /*stateSunCalc();*/
 
@@ -262,16 +410,52 @@ int main(int argc, char **argv)
       exit(1);
     }
 
-  i = open_lcnport();
-  if (i<0)
+  /* recorded traffic replaces the LCN-PK */
+  if (_conf.lcnReplayName != NULL) _conf.lcnInterface = NULL;
+
+  if (_conf.lcnPchk && _conf.lcnInterface != NULL) _lcnTrans = &_lcnTransPchk;
+
+  lcnFramerInit(&_lcnRx, lcnPakProc, lcnPakTrace);
+  _lcnRx.verbose = _conf.showLcnTraffic;
+
+  if (evLoopInit() != 0)
+    {
+      fprintf(stderr, "error initializing event loop\n");
+      exit(1);
+    }
+
+  /* the LCN-PCHK transport watches its socket itself (reconnects) */
+  lcnFd = _lcnTrans->open();
+  if (lcnFd<0)
     {
       fprintf(stderr, "error %s not available\n", _conf.lcnInterface);
       exit(1);
     }
 
-  timer_start();
+  if (_conf.lcnBinLogBasename != NULL && lcnLogOpen(_conf.lcnBinLogBasename) != 0)
+    {
+      fprintf(stderr, "error opening LCN log \"%s\"\n", _conf.lcnBinLogBasename);
+      exit(1);
+    }
+
+  memset(&tickTimer, 0, sizeof(tickTimer));
+  evTimerStart(&tickTimer, 1.0, 0.1, yaliTick, NULL);
 
   srvSock = netServerOpen();
+  evFdAdd(srvSock, EV_READ, yaliSrvEvent, NULL);
+
+  if (_conf.lcnInterface)
+    {
+      if (lcnFd > 0) evFdAdd(lcnFd, EV_READ, yaliSerEvent, NULL);
+      lcnSendInit();
+    }
+
+  if (_conf.lcnReplayName != NULL
+      && lcnReplayStart(&replay, _conf.lcnReplayName, _conf.lcnReplaySpeed) != 0)
+    {
+      fprintf(stderr, "error replay \"%s\" not available\n", _conf.lcnReplayName);
+      exit(1);
+    }
 
   /*
   printf("%s (Version %i.%i)\n",
@@ -279,72 +463,12 @@ int main(int argc, char **argv)
   */
 
   signal(SIGPIPE, handleSigPipe);    /* handler for SIGPIPE */
+  signal(SIGTERM, handleSigTerm);
+  signal(SIGINT, handleSigTerm);
 
-  while (1)
-    {
-      netClientAccept(srvSock);
-
-      if (_conf.lcnInterface)
-	{
-	  static unsigned long ltime = 0;
-	  /* this should be fixed somewhen */
-	  if (ltime != _tick)
-	    {
-	      ltime = _tick;
-	      lcnSendNext(_lcnSerFd);
-	      yaliRefresh();
-	    }
-	}
-
-      maxfd = _lcnSerFd;
-
-      FD_ZERO(&readfs);
-      FD_ZERO(&errorfs);
-
-      if (_conf.lcnInterface) FD_SET(_lcnSerFd, &readfs);
-
-      for (i=0; i<CLI_NUM; i++)
-	{
-	  if (_cli[i].sf != -1)
-	    {
-	      FD_SET(_cli[i].sf, &readfs);
-	      FD_SET(_cli[i].sf, &errorfs);
-	      if (_cli[i].sf > maxfd) maxfd = _cli[i].sf;
-	    }
-	}
-
-      maxfd += 1;
-
-      tmp = select(maxfd, &readfs, NULL, &errorfs, NULL);
-      if (tmp == -1)
-	{
-	  stateShutCheck();
-	  continue;
-	}
-
-      if (_conf.lcnInterface && FD_ISSET(_lcnSerFd, &readfs))
-	{
-	  lcnSerDataGet(_lcnSerFd);
-	}
-
-      for (i=0; i<CLI_NUM; i++)
-	{
-	  if (_cli[i].sf != -1)
-	    {
-	      if (FD_ISSET(_cli[i].sf, &readfs))
-		{
-		  /*printf("input on client %i\n", i);*/
-		  netSockDataGet(i);
-		}
-	      else if (FD_ISSET(_cli[i].sf, &errorfs))
-		{
-		  fprintf(stderr, "error on client %i\n", i);
-		  netSockTerm(i);
-		}
-	    }
-	}
-    }
+  evLoopRun();
 
+  lcnLogClose();
   close(srvSock);
 
   return 0;